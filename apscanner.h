@@ -0,0 +1,656 @@
+/**
+ * libapscanner - wifi access point scanning on top of libnl / nl80211
+ *
+ * Code applied from:
+ * - libnl sources LGPL2.1 https://www.infradead.org/~tgr/libnl/
+ * - example code from Python libnl port (LGPL2.1):
+ *	 https://github.com/Robpol86/libnl/blob/master/example_c/scan_access_points.c
+ * - as well as iw(8) source code (MIT).
+ *   https://git.sipsolutions.net/iw.git/tree/scan.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * The scanner runs nl80211 scans on one or more interfaces and decodes every BSS
+ * of the results into a struct bss_record, which is handed to a callback. There
+ * is no global state, every scan context can be used from its own thread.
+ *
+ * Typical use:
+ *
+ *	struct scan_ctx ctx;
+ *	memset(&ctx, 0, sizeof(ctx));
+ *	ctx.diff_hysteresis = -1;
+ *	ctx.bss_cb = my_callback;
+ *	scan_ctx_add_target(&ctx, "wlan0");
+ *	if (scan_ctx_connect(&ctx) == 0 && scan_ctx_init(&ctx) == 0)
+ *		do_scan_cycle(&ctx);
+ *	scan_ctx_free(&ctx);
+ */
+
+#ifndef APSCANNER_H
+#define APSCANNER_H
+
+#include <signal.h>
+#include <linux/nl80211.h>
+#include <net/if.h>
+
+struct nl_sock;
+struct nl_msg;
+struct nlmsghdr;
+
+// How long to wait for each phase of a scan cycle, in milliseconds. 0 waits forever.
+struct scan_timeouts {
+	long ack_ms;	// kernel reply to NL80211_CMD_TRIGGER_SCAN
+	long scan_ms;	// NL80211_CMD_NEW_SCAN_RESULTS or NL80211_CMD_SCAN_ABORTED event
+	long dump_ms;	// complete NL80211_CMD_GET_SCAN dump
+};
+
+// Scans that another process got in the way of, rejected with EBUSY or aborted,
+// are triggered again after a backoff that doubles from initial_ms up to max_ms,
+// with jitter (max_ms 0 does not cap it), as long as deadline_ms since the start
+// of the cycle have not passed. deadline_ms 0 disables the retries.
+struct scan_retry {
+	long deadline_ms;
+	long initial_ms;
+	long max_ms;
+	// without a scan of its own, a target reports the kernel's cached results
+	// that are younger than this instead of failing, 0 disables the fallback
+	long cache_age_ms;
+};
+
+const int MAX_SCAN_FREQS = 64;
+const int MAX_SCAN_SSIDS = 16;
+const int MAX_MATCH_SETS = 16;
+
+// What a scan covers, the same for every target. Empty lists scan all channels
+// with the wildcard SSID.
+struct scan_params {
+	__u32 freqs[MAX_SCAN_FREQS];	// MHz
+	int nfreqs;
+	const char* ssids[MAX_SCAN_SSIDS];
+	int nssids;
+	__u16 duration_tu;		// dwell time per channel, 0 = driver default
+	__u32 flags;			// NL80211_SCAN_FLAG_*
+
+	// scheduled scans, see do_sched_scan(): the firmware scans every
+	// sched_interval_ms and only reports BSSes of the match sets, one per SSID,
+	// that are at least as strong as match_rssi (dBm, 0 = any strength)
+	__u32 sched_interval_ms;
+	const char* match_ssids[MAX_MATCH_SETS];
+	int nmatch_ssids;
+	int match_rssi;
+};
+
+const int MAX_FILTER_SSIDS = 16;
+
+// Bands for scan_filter.bands
+enum {
+	SCAN_BAND_2GHZ		= 1 << 0,
+	SCAN_BAND_5GHZ		= 1 << 1,
+	SCAN_BAND_6GHZ		= 1 << 2,
+	SCAN_BAND_60GHZ		= 1 << 3,
+};
+
+// Kinds of security for scan_filter.security, see bss_security()
+enum {
+	SCAN_SECURITY_OPEN	= 1 << 0,	// neither RSN nor WPA, no privacy bit
+	SCAN_SECURITY_WEP	= 1 << 1,	// neither RSN nor WPA, privacy bit
+	SCAN_SECURITY_PSK	= 1 << 2,	// PSK, FT/PSK or PSK/SHA-256
+	SCAN_SECURITY_SAE	= 1 << 3,	// SAE or FT/SAE
+	SCAN_SECURITY_EAP	= 1 << 4,	// IEEE 802.1X and FILS suites
+	SCAN_SECURITY_OWE	= 1 << 5,
+};
+
+// Which BSSes are reported. The others are dropped as soon as the attributes of
+// their message are parsed: they are not decoded or reported, and diff mode, the
+// IE cache and the shared memory table do not see them either. A BSS has to pass
+// every criterion that is set, the cheapest are checked first.
+struct scan_filter {
+	int min_signal_mbm;		// 0 = any, BSSes without a signal in mBm pass
+	unsigned int bands;		// SCAN_BAND_*, 0 = any
+	const char* ssid_globs[MAX_FILTER_SSIDS];	// fnmatch() patterns, one has to match
+	int nssid_globs;
+	unsigned int security;		// SCAN_SECURITY_*, one has to match, 0 = any
+};
+
+// How the netlink receive path is sized, see scan_ctx_init()
+struct scan_buffers {
+	int recv_size;		// initial receive buffer in bytes, 0 = 32 KiB
+	bool recv_peek;		// peek at the size of every datagram and grow the buffer first
+	int socket_size;	// SO_RCVBUF of the socket in bytes, 0 = system default
+	int max_dump_restarts;	// restarts of an interrupted dump, 0 = never restart
+};
+
+// How often the receive path ran into trouble, counted over the life of a scan context
+struct scan_counters {
+	unsigned long enobufs;		// the socket receive queue overflowed, events were lost
+	unsigned long truncated;	// datagrams cut off by a receive buffer that was too small
+	unsigned long buffer_grown;	// the receive buffer was enlarged
+	unsigned long dump_intr;	// dumps that were interrupted (NLM_F_DUMP_INTR or truncated)
+	unsigned long dump_restarts;	// interrupted dumps that were started again
+};
+
+// Latency histogram. The buckets are not cumulative, bucket i counts the durations
+// up to SCAN_HISTOGRAM_BOUNDS_US[i] that did not fit into bucket i - 1, and the last
+// one those above all bounds.
+const int SCAN_HISTOGRAM_BUCKETS = 26;
+const long SCAN_HISTOGRAM_BOUNDS_US[SCAN_HISTOGRAM_BUCKETS - 1] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500,
+	1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000,
+	1000000, 2000000, 5000000, 10000000, 20000000, 50000000, 100000000,
+};
+
+struct scan_histogram {
+	unsigned long count;
+	unsigned long long sum_ns;
+	unsigned long buckets[SCAN_HISTOGRAM_BUCKETS];
+};
+
+// The timed phases of a scan cycle. Passive and scheduled scan mode have no ack
+// and scan phase, their cycle starts with the scan event.
+enum scan_phase {
+	PHASE_ACK,		// NL80211_CMD_TRIGGER_SCAN sent until it was acked
+	PHASE_SCAN,		// acked until the scan event, the time the driver scanned
+	PHASE_DUMP_WAIT,	// NL80211_CMD_GET_SCAN sent until its first message
+	PHASE_DUMP,		// first until last message of a dump, restarts included
+	PHASE_BSS,		// decoding of one BSS, without the bss callback
+	PHASE_CYCLE,		// trigger sent until the dump is done
+	SCAN_PHASES,
+};
+
+// Where the time of the scans goes, collected while scan_ctx.stats is set
+struct scan_stats {
+	struct scan_histogram phases[SCAN_PHASES];
+	unsigned long triggers;		// scans requested
+	unsigned long aborts;		// scans that ended with NL80211_CMD_SCAN_ABORTED
+	unsigned long busy;		// scan requests rejected with EBUSY
+	unsigned long dumps;		// complete dumps
+	unsigned long bss;		// BSSes received
+	unsigned long long bytes;	// netlink bytes received
+};
+
+// What changed about a BSS since the previous dump in diff mode. Without diff
+// mode every BSS is reported with BSS_ALL.
+enum {
+	BSS_NEW		= 1 << 0,
+	BSS_SIGNAL	= 1 << 1,
+	BSS_FREQ	= 1 << 2,
+	BSS_CAPA	= 1 << 3,
+	BSS_IES		= 1 << 4,
+	BSS_ALL		= BSS_NEW | BSS_SIGNAL | BSS_FREQ | BSS_CAPA | BSS_IES,
+
+	// the BSS was not in the last dump, only bssid and ifname are set
+	BSS_GONE	= 1 << 5,
+};
+
+// How an information element was found in a frame
+enum ie_status {
+	IE_ABSENT,
+	IE_PRESENT,
+	IE_INVALID,	// length out of range, nothing was decoded
+};
+
+struct ie_state {
+	__u8 status;	// ie_status
+	__u8 len;	// length of the element data
+	__u8 first;	// first byte of an invalid element of length 1
+};
+
+// SSID element, up to 32 bytes that are not necessarily text
+struct ssid_info {
+	struct ie_state ie;
+	__u8 len;
+	__u8 data[32];
+};
+
+// A list of suites fills at most the 247 bytes an element has after the version
+// and the group cipher, so every suite of an element fits
+const int MAX_IE_SUITES = 61;
+
+// Fields of an RSN or WPA element that were present, or filled in with the
+// defaults of the element type when it ends early
+enum {
+	RSN_GROUP_CIPHER	= 1 << 0,
+	RSN_PAIRWISE		= 1 << 1,
+	RSN_AKM			= 1 << 2,
+	RSN_CAPABILITIES	= 1 << 3,
+	RSN_PMKID_COUNT		= 1 << 4,
+	RSN_GROUP_MGMT_CIPHER	= 1 << 5,
+};
+
+// RSN or WPA element. Cipher and AKM suites are OUI << 8 | suite type, see
+// cipher_suite_name() and akm_suite_name().
+struct rsn_info {
+	struct ie_state ie;
+	__u32 fields;		// RSN_*
+	__u16 version;
+	__u32 group_cipher;
+	int npairwise;
+	__u32 pairwise[MAX_IE_SUITES];
+	int nakm;
+	__u32 akm[MAX_IE_SUITES];
+	__u16 capabilities;
+	__u16 pmkid_count;
+	__u32 group_mgmt_cipher;
+
+	// data that could not be decoded at the end of the element
+	__u8 tail_len;
+	__u8 tail[255];
+};
+
+// WPS attributes that were present
+enum {
+	WPS_VERSION		= 1 << 0,
+	WPS_DEVICE_NAME		= 1 << 1,
+	WPS_PASSWORD_ID		= 1 << 2,
+	WPS_MANUFACTURER	= 1 << 3,
+	WPS_MODEL		= 1 << 4,
+	WPS_MODEL_NUMBER	= 1 << 5,
+	WPS_RESPONSE_TYPE	= 1 << 6,
+	WPS_RF_BANDS		= 1 << 7,
+	WPS_SELECTED_REGISTRAR	= 1 << 8,
+	WPS_SERIAL_NUMBER	= 1 << 9,
+	WPS_STATE		= 1 << 10,
+	WPS_UUID		= 1 << 11,
+	WPS_VERSION2		= 1 << 12,
+	WPS_DEVICE_TYPE		= 1 << 13,
+	WPS_AP_SETUP_LOCKED	= 1 << 14,
+	WPS_CONFIG_METHODS	= 1 << 15,
+	WPS_SR_CONFIG_METHODS	= 1 << 16,
+};
+
+// WPS vendor element. Strings are cut at the maximum length of the WPS
+// specification and at the first NUL byte.
+struct wps_info {
+	struct ie_state ie;
+	__u32 fields;		// WPS_*
+	__u8 version;		// major << 4 | minor
+	__u8 version2;
+	__u8 state;		// 1 unconfigured, 2 configured
+	__u8 response_type;
+	__u8 rf_bands;
+	__u8 selected_registrar;
+	__u8 ap_setup_locked;
+	__u16 password_id;
+	__u16 config_methods;
+	__u16 sr_config_methods;	// selected registrar config methods
+	__u8 uuid[16];
+	__u16 device_category;
+	__u8 device_oui[4];
+	__u16 device_subcategory;
+	char device_name[33];
+	char manufacturer[65];
+	char model[33];
+	char model_number[33];
+	char serial_number[33];
+};
+
+// The decoded information elements of one frame. Only the first element of
+// each kind is decoded.
+struct bss_ies {
+	struct ssid_info ssid;
+	struct rsn_info rsn;
+	struct rsn_info wpa;
+	struct wps_info wps;
+};
+
+// Kinds of elements for decode_ies(), the ones left out stay IE_ABSENT
+enum {
+	DECODE_SSID		= 1 << 0,
+	DECODE_RSN		= 1 << 1,
+	DECODE_WPA		= 1 << 2,
+	DECODE_WPS		= 1 << 3,
+	DECODE_ALL		= DECODE_SSID | DECODE_RSN | DECODE_WPA | DECODE_WPS,
+};
+
+// One BSS of a scan dump
+struct bss_record {
+	unsigned char bssid[6];
+	const char* ifname;	// interface the BSS was seen on
+	int changes;		// BSS_* flags
+
+	bool has_signal_mbm;
+	int signal_mbm;
+	bool has_signal_unspec;
+	__u8 signal_unspec;	// 0..100
+	__u32 freq;		// MHz, 0 if not reported
+	__u32 freq_offset;	// kHz
+	bool has_capability;
+	__u16 capability;
+	bool has_seen_ms_ago;
+	__u32 seen_ms_ago;	// when the BSS was last received, at the time of the dump
+
+	// raw elements of the last received frame and of the last beacon, they point
+	// into the netlink message and are only valid during the callback
+	const __u8* ies;
+	int ies_len;
+	const __u8* beacon_ies;
+	int beacon_ies_len;
+	__u64 ie_hash;		// fingerprint of both, 0 unless a diff table, IE cache or shm compares it
+
+	// Elements of the last received frame (probe response or beacon). When the
+	// last beacon carried different elements they are decoded into beacon as well,
+	// otherwise beacon is not set. In diff mode the elements are only decoded if
+	// changes has BSS_IES.
+	struct bss_ies elements;
+	bool beacon_differs;
+	struct bss_ies beacon;
+};
+
+// Called for every BSS of a dump, and in diff mode for every BSS that is gone
+typedef void (*bss_callback)(const struct bss_record* bss, void* arg);
+
+// Called after every complete dump of an interface, once its BSSes were reported
+typedef void (*dump_callback)(const char* ifname, void* arg);
+
+// Called when the descriptor of scan_ctx.poll_fd is readable
+typedef void (*poll_callback)(void* arg);
+
+enum {
+	SCAN_LOG_INFO,		// progress
+	SCAN_LOG_ERROR,
+};
+
+// Receives the progress and error messages of the scanner, without a newline
+typedef void (*scan_log_callback)(int level, const char* message, void* arg);
+
+// How the BSSes of an interface changed between its last two complete dumps,
+// counted while scan_ctx.churn_signal_mbm is set
+struct scan_churn {
+	bool valid;		// there was a previous dump to compare with
+	int bsses;		// in the last dump
+	int added;		// not in the previous dump
+	int removed;		// in the previous dump only
+	int moved;		// signal changed by at least scan_ctx.churn_signal_mbm
+};
+
+// Progress of a single interface through a scan cycle
+enum target_state {
+	TARGET_IDLE,
+	TARGET_TRIGGERED,	// NL80211_CMD_TRIGGER_SCAN sent, waiting for the ack
+	TARGET_SCANNING,	// scan acked (or passive mode), waiting for the scan event
+	TARGET_SCANNED,		// scan done, results not dumped yet
+	TARGET_DUMPING,		// NL80211_CMD_GET_SCAN dump in flight
+	TARGET_DONE,
+	TARGET_FAILED,
+};
+
+struct bss_table;
+struct churn_table;
+struct split_scan;
+struct ie_cache;
+struct dump_log;
+struct scan_recording;
+struct scan_shm;
+
+// An interface that is scanned. All interfaces share the socket and the
+// multicast subscription of the scan context, messages are demultiplexed by
+// sequence number (replies) and ifindex (scan events).
+struct scan_target {
+	char ifname[IF_NAMESIZE];
+	int if_index;
+	int wiphy;		// -1 if not known
+
+	// prebuilt NL80211_CMD_TRIGGER_SCAN and NL80211_CMD_GET_SCAN requests, and
+	// NL80211_CMD_START_SCHED_SCAN in scheduled scan mode
+	struct nl_msg* trigger_msg;
+	struct nl_msg* dump_msg;
+	struct nl_msg* sched_msg;
+
+	// sequence number of the request in flight and its state: 1 while waiting,
+	// 0 once acked or finished, negative error code from the kernel otherwise.
+	// Replies with another sequence number are late replies to a request that
+	// timed out and are ignored.
+	unsigned int req_seq;
+	int req_status;
+
+	enum target_state state;
+	int err;		// error of a failed cycle, returned as exit code
+	bool aborted;		// the scan of the cycle failed with NL80211_CMD_SCAN_ABORTED
+
+	// passive and scheduled scan mode: new results were announced while the
+	// previous ones were dumped
+	bool rescan_pending;
+
+	// CLOCK_MONOTONIC ns of the steps of the cycle in flight, kept with scan_ctx.stats
+	long long cycle_ns;	// trigger sent, or scan event without a trigger
+	long long request_ns;	// request in flight sent
+	long long ack_ns;
+	long long first_msg_ns;	// of the dump in flight, 0 before the first one
+	long long last_msg_ns;
+
+	// the subset of scan_params.flags and the dwell time the driver supports
+	__u32 scan_flags;
+	bool dwell_supported;
+
+	// the dump in flight lost messages or the BSS list changed while it ran
+	// (NLM_F_DUMP_INTR), it is restarted once it is done
+	bool dump_intr;
+	int dump_restarts;	// of the dump in flight
+	int dump_bss;		// BSSes the dump in flight delivered
+
+	// the dump in flight skips BSSes last seen before this CLOCK_MONOTONIC ms, 0 none
+	long long fresh_since_ms;
+
+	// scan_ctx.max_age_ms: the dump in flight only looks at the cache and reports
+	// nothing. It notes the CLOCK_MONOTONIC ms the newest BSS was seen, overall
+	// and on each channel of scan_params, 0 if none was.
+	bool probing;
+	long long probe_newest_ms;
+	long long probe_freq_newest_ms[MAX_SCAN_FREQS];
+
+	// trigger of the cycle in flight for only the stale channels, NULL otherwise
+	struct nl_msg* partial_msg;
+
+	// BSSIDs the dump in flight has delivered, so that a restart does not deliver
+	// them again. NULL if dumps are never restarted.
+	struct dump_log* dump_log;
+
+	// previous results in diff mode, NULL otherwise
+	struct bss_table* table;
+
+	// BSSes of the previous dump and what changed since, while churn is counted
+	struct churn_table* churn_table;
+	struct scan_churn churn;
+
+	// channels and BSSes of split channel scanning, NULL otherwise
+	struct split_scan* split;
+
+	// decoded information elements in interval and passive mode, NULL otherwise
+	struct ie_cache* ie_cache;
+};
+
+const int MAX_SCAN_TARGETS = 16;
+
+// Netlink resources that are set up once and then reused for every scan cycle.
+// In daemon mode this saves reconnecting the socket and the two controller
+// round-trips (family id and multicast group lookup) on every scan.
+struct scan_ctx {
+	struct nl_sock* socket;
+	int family_id;
+	int mcid;
+
+	// every message is received into this buffer and handled in place
+	void* recv_buf;
+	size_t recv_buf_size;
+
+	struct scan_buffers buffers;
+	struct scan_counters counters;
+
+	// timing of the scans is added up here, NULL does not take the time
+	struct scan_stats* stats;
+
+	struct scan_target targets[MAX_SCAN_TARGETS];
+	int ntargets;
+
+	// target whose dump is in flight, only one dump can run per socket
+	struct scan_target* dumping;
+
+	struct scan_timeouts timeouts;
+	struct scan_retry retry;
+
+	// scan only this many channels per cycle, the next ones in the cycles after,
+	// and report the BSSes of all channels every cycle, see query_scan_channels().
+	// 0 scans all channels every cycle.
+	int split_channels;
+
+	// report the cached results instead of scanning as long as they are at most
+	// this old, with scan_params.freqs only the stale channels are scanned.
+	// 0 always scans.
+	long max_age_ms;
+
+	struct scan_params params;
+	struct scan_filter filter;
+
+	// never trigger, only dump when another process' scan completes
+	bool passive;
+
+	// program a scheduled scan once and dump whenever it reports results
+	bool sched;
+
+	// report only what changed since the previous dump, with this hysteresis
+	// for the signal strength (mBm). Negative disables diff mode.
+	int diff_hysteresis;
+
+	// keep the decoded information elements between dumps
+	bool use_ie_cache;
+
+	// count the changes between the dumps of every target in scan_target.churn,
+	// where a signal change of at least this much (mBm) counts. 0 does not count.
+	int churn_signal_mbm;
+
+	// DECODE_* kinds of elements nobody looks at, they are not decoded. If all
+	// of them are skipped the elements are not even walked.
+	unsigned int skip_ies;
+
+	bss_callback bss_cb;
+	void* bss_cb_arg;
+
+	// NULL if not needed
+	dump_callback dump_cb;
+	void* dump_cb_arg;
+
+	// another descriptor that is watched while the scanner waits, e.g. of a server
+	// that has to answer while a scan is running. Unused if poll_cb is NULL.
+	int poll_fd;
+	poll_callback poll_cb;
+	void* poll_cb_arg;
+
+	// NULL discards the messages
+	scan_log_callback log_cb;
+	void* log_cb_arg;
+
+	// set (e.g. from a signal handler) to make the running call return
+	volatile sig_atomic_t stop;
+
+	// raw netlink messages are written here, see scan_record_open()
+	struct scan_recording* recording;
+
+	// the BSS table is published here, see scan_shm_open()
+	struct scan_shm* shm;
+};
+
+// scanner.cpp
+
+// Adds an interface by name, returns non-zero if it does not exist or there are too many
+int scan_ctx_add_target(struct scan_ctx* ctx, const char* ifname);
+
+// Allocates and connects the netlink socket and resolves the nl80211 family
+int scan_ctx_connect(struct scan_ctx* ctx);
+
+// Adds one interface of every wiphy to the targets, call after scan_ctx_connect()
+int discover_interfaces(struct scan_ctx* ctx);
+
+// Checks which of the requested scan flags and the dwell time the driver of a
+// target supports, call after scan_ctx_connect() and before scan_ctx_init()
+int query_scan_support(struct scan_ctx* ctx, struct scan_target* target);
+
+// Reads the channels the wiphy of a target can scan, for scan_ctx.split_channels.
+// With scan_params.freqs those are taken instead. Call after scan_ctx_connect()
+// and before scan_ctx_init().
+int query_scan_channels(struct scan_ctx* ctx, struct scan_target* target);
+
+// Builds the requests of all targets, call once the targets are set up
+int scan_ctx_init(struct scan_ctx* ctx);
+
+// Frees everything scan_ctx_connect() and scan_ctx_init() allocated
+void scan_ctx_free(struct scan_ctx* ctx);
+
+// Scans all targets once, returns 0 or the error of the first target that failed
+int do_scan_cycle(struct scan_ctx* ctx);
+
+// Reports the results of other processes' scans until stopped or count dumps
+// were done (0 = forever)
+int do_passive_listen(struct scan_ctx* ctx, long count);
+
+// Starts a scheduled scan on all targets and reports its results until stopped or
+// count dumps were done (0 = forever). Needs sched set before scan_ctx_init().
+int do_sched_scan(struct scan_ctx* ctx, long count);
+
+// Writes every netlink message of the following scans to a file, with a timestamp,
+// for do_replay(). Call before scan_ctx_init().
+int scan_record_open(struct scan_ctx* ctx, const char* path);
+
+// Publishes the BSSes of the last complete dump of every target in a file that
+// other processes map, e.g. in /dev/shm; apscanner_shm.h reads it. The file is
+// replaced, not rewritten, and stays when the scan context is freed.
+int scan_shm_open(struct scan_ctx* ctx, const char* path);
+
+// Name of a scan_phase for reports, e.g. "dump_wait"
+const char* scan_phase_name(int phase);
+
+// Feeds a recording through the same decoding and reporting as a live scan,
+// without a socket. The targets come from the recording, the context must not
+// have any. realtime keeps the recorded timing, otherwise it runs at full speed.
+int do_replay(struct scan_ctx* ctx, const char* path, bool realtime);
+
+// decoder.cpp
+
+// Fills in everything but the decoded elements from a NL80211_CMD_GET_SCAN message,
+// e.g. nlmsg_hdr() of a received nl_msg. Returns 0, -NLE_MISSING_ATTR if the BSSID
+// or the elements are missing, or another libnl error code.
+int parse_scan_result(struct nlmsghdr* hdr, struct bss_record* bss);
+
+// Decodes the elements and beacon of a record filled in by parse_scan_result(),
+// only the DECODE_* kinds
+void decode_bss_ies(struct bss_record* bss, unsigned int kinds = DECODE_ALL);
+
+// parse_scan_result() and decode_bss_ies() at once
+int decode_scan_result(struct nlmsghdr* hdr, struct bss_record* bss);
+
+// Decodes the DECODE_* kinds of a blob of information elements
+void decode_ies(const __u8* ie, int ielen, struct bss_ies* ies, unsigned int kinds = DECODE_ALL);
+
+// Fingerprint of the raw elements of a record, the beacon only when it differs.
+// Not set by parse_scan_result(), the scanner computes it for the BSSes it compares.
+__u64 hash_bss_ies(const struct bss_record* bss);
+
+// First element with the id in a blob of information elements, NULL if there is
+// none. Points at the id, the length follows.
+const __u8* find_ie(const __u8* ie, int ielen, __u8 id);
+
+// SCAN_SECURITY_* of a record filled in by parse_scan_result(), from its AKM suites
+// or its privacy bit. Only the raw RSN and WPA elements are looked at.
+unsigned int bss_security(const struct bss_record* bss);
+
+// Names of the known suites, NULL for others
+const char* cipher_suite_name(__u32 suite);
+const char* akm_suite_name(__u32 suite);
+
+// Formats a MAC address as aa:bb:cc:dd:ee:ff, mac_addr needs 18 bytes
+void mac_addr_n2a(char* mac_addr, const unsigned char* arg);
+
+#endif
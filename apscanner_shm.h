@@ -0,0 +1,225 @@
+/**
+ * libapscanner - reader of the BSS table published in shared memory
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * The scanner publishes the BSSes of the last complete dump of every interface
+ * into a file, see scan_shm_open(). This header is all a reader needs, it does not
+ * link against the library and can be used from C.
+ *
+ * The file holds two tables. The writer fills the one readers are not directed to
+ * and then makes it the current one by bumping the generation, so a reader only
+ * has to retry if the writer published twice while it was reading. Every table
+ * has a sequence count that is odd while the writer fills it; a reader takes its
+ * value before reading and checks that it did not change afterwards. Reading
+ * takes no system call and no lock, and the writer never waits for readers.
+ *
+ *	struct apscan_shm shm;
+ *	if (apscan_shm_open(&shm, "/dev/shm/ap-scanner") == 0) {
+ *		const struct apscan_shm_table* table;
+ *		__u64 seq;
+ *		do {
+ *			table = apscan_shm_begin(&shm, &seq);
+ *			... read table->count entries of apscan_shm_entries(table), at
+ *			    most the capacity of the apscan_shm_header at shm.base ...
+ *		} while (apscan_shm_retry(table, seq));
+ *		apscan_shm_close(&shm);
+ *	}
+ *
+ * Until apscan_shm_retry() returns 0 the entries may be torn, anything taken from
+ * them must not be acted on before that. That includes the count: a torn count
+ * can be larger than the table, so a reader clamps it to the capacity before it
+ * indexes the entries.
+ */
+
+#ifndef APSCANNER_SHM_H
+#define APSCANNER_SHM_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/types.h>
+
+#define APSCAN_SHM_MAGIC	"APSCANSM"
+#define APSCAN_SHM_VERSION	1
+
+// interfaces a table can name, and the size of a name
+#define APSCAN_SHM_MAX_INTERFACES	16
+#define APSCAN_SHM_IFNAMSIZ		16
+
+// Fields of an entry that the driver reported
+enum {
+	APSCAN_BSS_SIGNAL_MBM		= 1 << 0,
+	APSCAN_BSS_SIGNAL_UNSPEC	= 1 << 1,
+	APSCAN_BSS_CAPABILITY		= 1 << 2,
+	APSCAN_BSS_SSID			= 1 << 3,
+};
+
+// One BSS, 64 bytes
+struct apscan_shm_bss {
+	unsigned char bssid[6];
+	__u8 iface;		// index into the ifnames of the table
+	__u8 flags;		// APSCAN_BSS_*
+	__s32 signal_mbm;
+	__u32 freq;		// MHz, 0 if not reported
+	__u16 capability;
+	__u8 signal_unspec;	// 0..100
+	__u8 ssid_len;
+	__u32 reserved;
+	__u64 ie_hash;		// changes when the information elements change
+	__u8 ssid[32];		// not necessarily text
+};
+
+struct apscan_shm_table {
+	__u64 seq;		// odd while the writer fills the table
+	__u64 generation;	// of the table, 0 if nothing was published yet
+	__u64 time_ns;		// CLOCK_REALTIME of the publication
+	__u32 count;		// entries that follow
+	__u32 total;		// BSSes found, more than count if they did not fit
+	char ifnames[APSCAN_SHM_MAX_INTERFACES][APSCAN_SHM_IFNAMSIZ];
+	// followed by the entries
+};
+
+struct apscan_shm_header {
+	char magic[8];		// APSCAN_SHM_MAGIC, without the NUL
+	__u32 version;		// APSCAN_SHM_VERSION
+	__u32 entry_size;	// sizeof(struct apscan_shm_bss)
+	__u32 capacity;		// entries per table
+	__u32 closed;		// the writer has exited, a new one replaces the file
+	__u64 generation;	// of the current table, which is table_offset[generation & 1]
+	__u64 table_offset[2];	// from the start of the file
+};
+
+// A mapped file
+struct apscan_shm {
+	const void* base;
+	size_t size;
+};
+
+// Maps the file of a writer. Returns 0 or a negative error code, -EPROTO if it is
+// not a table of this version.
+static inline int apscan_shm_open(struct apscan_shm* shm, const char* path) {
+	const struct apscan_shm_header* hdr;
+	struct stat st;
+	void* base;
+	int fd;
+
+	shm->base = NULL;
+	shm->size = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) != 0) {
+		int err = -errno;
+		close(fd);
+		return err;
+	}
+
+	if ((size_t)st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -EPROTO;
+	}
+
+	base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -errno;
+
+	hdr = (const struct apscan_shm_header*)base;
+	if (memcmp(hdr->magic, APSCAN_SHM_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->version != APSCAN_SHM_VERSION || hdr->entry_size != sizeof(struct apscan_shm_bss) ||
+		hdr->table_offset[0] + sizeof(struct apscan_shm_table) + (__u64)hdr->capacity * hdr->entry_size > (__u64)st.st_size ||
+		hdr->table_offset[1] + sizeof(struct apscan_shm_table) + (__u64)hdr->capacity * hdr->entry_size > (__u64)st.st_size) {
+		munmap(base, (size_t)st.st_size);
+		return -EPROTO;
+	}
+
+	shm->base = base;
+	shm->size = (size_t)st.st_size;
+	return 0;
+}
+
+static inline void apscan_shm_close(struct apscan_shm* shm) {
+	if (shm->base != NULL)
+		munmap((void*)shm->base, shm->size);
+	shm->base = NULL;
+	shm->size = 0;
+}
+
+// True once the writer has exited. The last table stays readable, a writer that
+// is started again publishes into a new file under the same name.
+static inline int apscan_shm_closed(const struct apscan_shm* shm) {
+	const struct apscan_shm_header* hdr = (const struct apscan_shm_header*)shm->base;
+	return __atomic_load_n(&hdr->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Starts reading the current table, seq is for apscan_shm_retry()
+static inline const struct apscan_shm_table* apscan_shm_begin(const struct apscan_shm* shm, __u64* seq) {
+	const struct apscan_shm_header* hdr = (const struct apscan_shm_header*)shm->base;
+
+	for (;;) {
+		__u64 generation = __atomic_load_n(&hdr->generation, __ATOMIC_ACQUIRE);
+		const struct apscan_shm_table* table = (const struct apscan_shm_table*)
+			((const char*)shm->base + hdr->table_offset[generation & 1]);
+
+		// odd if the writer has moved on by two tables since generation was read
+		*seq = __atomic_load_n(&table->seq, __ATOMIC_ACQUIRE);
+		if ((*seq & 1) == 0)
+			return table;
+	}
+}
+
+static inline const struct apscan_shm_bss* apscan_shm_entries(const struct apscan_shm_table* table) {
+	return (const struct apscan_shm_bss*)(table + 1);
+}
+
+// Non-zero if the table was overwritten while it was read, the read has to start
+// over with apscan_shm_begin()
+static inline int apscan_shm_retry(const struct apscan_shm_table* table, __u64 seq) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&table->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// Copies the current table, for readers that want to keep it. Returns the number
+// of entries copied, at most max, and the generation of the table.
+static inline __u32 apscan_shm_copy(const struct apscan_shm* shm, struct apscan_shm_bss* entries, __u32 max,
+	__u64* generation) {
+	const struct apscan_shm_header* hdr = (const struct apscan_shm_header*)shm->base;
+	const struct apscan_shm_table* table;
+	__u32 count;
+	__u64 seq;
+
+	if (max > hdr->capacity)
+		max = hdr->capacity;
+
+	do {
+		table = apscan_shm_begin(shm, &seq);
+		count = table->count < max ? table->count : max;
+		memcpy(entries, apscan_shm_entries(table), count * sizeof(*entries));
+		*generation = table->generation;
+	} while (apscan_shm_retry(table, seq));
+
+	return count;
+}
+
+#endif
@@ -0,0 +1,548 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * Benchmarks of the information element decoders and of the dump processing of
+ * libapscanner over a synthetic corpus, built and run with `make bench`. Needs no
+ * wifi hardware: the end-to-end benchmark replays a generated recording.
+ *
+ * Every benchmark prints one JSON object per line:
+ *	{"bench":"<name>","iterations":<n>,"ns_per_bss":<ns>,"bytes_per_s":<b>,"allocs_per_bss":<a>}
+ *
+ * The end-to-end benchmarks count the allocations after the first dump, which
+ * sets up the buffers and tables. With --check (`make check`) the program fails if
+ * dump/plain or dump/ie-cache allocates anything in that steady state, or if the
+ * RSN decoder drops suites of a long element.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netlink/genl/genl.h>
+#include <string>
+#include <vector>
+
+#include "../apscanner.h"
+
+// glibc's own allocator, wrapped to count the allocations of the benchmarked code,
+// including the ones made inside libnl and the C++ runtime
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static unsigned long allocations = 0;
+
+extern "C" void* malloc(size_t size) {
+	allocations++;
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+	allocations++;
+	return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr) {
+	__libc_free(ptr);
+}
+
+const int DEFAULT_BSS_COUNT = 500;
+const int DEFAULT_DUMPS = 20;
+const long MIN_BENCH_NS = 200000000;
+
+// the family id of nl80211 is assigned at runtime, a replay does not check it
+const int NL80211_FAMILY_ID = 28;
+
+typedef std::vector<__u8> bytes;
+
+static long long monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping work whose result is not used otherwise
+static volatile __u32 sink;
+
+static void report(const char* name, long iterations, long long ns, unsigned long long bytes,
+	double allocs_per_bss) {
+	printf("{\"bench\":\"%s\",\"iterations\":%ld,\"ns_per_bss\":%.1f,\"bytes_per_s\":%.0f,\"allocs_per_bss\":%.2f}\n",
+		name, iterations, (double)ns / iterations, ns > 0 ? bytes * 1e9 / ns : 0.0, allocs_per_bss);
+	fflush(stdout);
+}
+
+// Synthetic information elements
+
+static void put_ie(bytes* out, __u8 id, const bytes& data) {
+	if (data.size() > 255) {
+		fprintf(stderr, "element %d too long: %zu\n", id, data.size());
+		exit(1);
+	}
+	out->push_back(id);
+	out->push_back((__u8)data.size());
+	out->insert(out->end(), data.begin(), data.end());
+}
+
+static void put_suite(bytes* out, __u8 type) {
+	__u8 suite[4] = { 0x00, 0x0f, 0xac, type };
+	out->insert(out->end(), suite, suite + 4);
+}
+
+static bytes ssid_ie(const char* ssid) {
+	bytes ie;
+	put_ie(&ie, 0, bytes(ssid, ssid + strlen(ssid)));
+	return ie;
+}
+
+// RSN element with the given number of pairwise and AKM suites, capabilities, one
+// PMKID and a group management cipher
+static bytes rsn_ie(int nsuites) {
+	bytes data = { 1, 0 };
+
+	put_suite(&data, 4);
+	data.push_back(nsuites);
+	data.push_back(0);
+	for (int i = 0; i < nsuites; i++)
+		put_suite(&data, i % 2 ? 2 : 4);
+	data.push_back(nsuites);
+	data.push_back(0);
+	for (int i = 0; i < nsuites; i++)
+		put_suite(&data, (i % 18) + 1);
+	data.push_back(0xcc);
+	data.push_back(0x00);
+	data.push_back(1);
+	data.push_back(0);
+	data.insert(data.end(), 16, 0x5a);
+	put_suite(&data, 6);
+
+	bytes ie;
+	put_ie(&ie, 48, data);
+	return ie;
+}
+
+static void put_wps_attr(bytes* out, __u16 type, const bytes& value) {
+	out->push_back(type >> 8);
+	out->push_back(type & 0xff);
+	out->push_back(value.size() >> 8);
+	out->push_back(value.size() & 0xff);
+	out->insert(out->end(), value.begin(), value.end());
+}
+
+static bytes wps_string(const char* prefix, size_t len) {
+	std::string s(prefix);
+	while (s.size() < len)
+		s += 'x';
+	return bytes(s.begin(), s.begin() + len);
+}
+
+// WPS element with every attribute the decoder knows and long strings, close to
+// the maximum element length
+static bytes wps_ie() {
+	bytes data = { 0x00, 0x50, 0xf2, 4 };
+
+	put_wps_attr(&data, 0x104a, { 0x10 });
+	put_wps_attr(&data, 0x1044, { 2 });
+	put_wps_attr(&data, 0x1057, { 1 });
+	put_wps_attr(&data, 0x1041, { 1 });
+	put_wps_attr(&data, 0x1012, { 0, 4 });
+	put_wps_attr(&data, 0x1053, { 0x42, 0x88 });
+	put_wps_attr(&data, 0x103b, { 3 });
+	put_wps_attr(&data, 0x1047, bytes(16, 0xa5));
+	put_wps_attr(&data, 0x1021, wps_string("Manufacturer", 32));
+	put_wps_attr(&data, 0x1023, wps_string("Model", 24));
+	put_wps_attr(&data, 0x1024, wps_string("Number", 16));
+	put_wps_attr(&data, 0x1042, wps_string("Serial", 16));
+	put_wps_attr(&data, 0x1054, { 0, 6, 0x00, 0x50, 0xf2, 4, 0, 1 });
+	put_wps_attr(&data, 0x1011, wps_string("Device", 24));
+	put_wps_attr(&data, 0x1008, { 0x42, 0x88 });
+	put_wps_attr(&data, 0x103c, { 3 });
+	put_wps_attr(&data, 0x1049, { 0x00, 0x37, 0x2a, 0x00, 0x01, 0x20 });
+
+	bytes ie;
+	put_ie(&ie, 221, data);
+	return ie;
+}
+
+static bytes wpa_ie() {
+	bytes data = { 0x00, 0x50, 0xf2, 1, 1, 0, 0x00, 0x50, 0xf2, 2, 1, 0, 0x00, 0x50, 0xf2, 4,
+		1, 0, 0x00, 0x50, 0xf2, 2 };
+	bytes ie;
+	put_ie(&ie, 221, data);
+	return ie;
+}
+
+// A beacon like the ones of current enterprise access points: many elements that
+// are skipped and a long tail of vendor elements
+static bytes vendor_heavy_ies() {
+	bytes ies = ssid_ie("vendor-heavy-network");
+
+	put_ie(&ies, 1, { 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24 });
+	put_ie(&ies, 3, { 6 });
+	put_ie(&ies, 5, { 0, 1, 0, 0 });
+	put_ie(&ies, 7, { 'D', 'E', ' ', 1, 13, 20 });
+	put_ie(&ies, 45, bytes(26, 0xef));
+	put_ie(&ies, 61, bytes(22, 0x06));
+	put_ie(&ies, 127, bytes(10, 0x04));
+	put_ie(&ies, 191, bytes(12, 0x91));
+	put_ie(&ies, 192, bytes(5, 0x01));
+	bytes rsn = rsn_ie(2);
+	ies.insert(ies.end(), rsn.begin(), rsn.end());
+	for (int i = 0; i < 24; i++) {
+		bytes vendor = { 0x00, 0x10, 0x18, (__u8)i };
+		vendor.insert(vendor.end(), 20 + i, (__u8)i);
+		put_ie(&ies, 221, vendor);
+	}
+	bytes wmm = { 0x00, 0x50, 0xf2, 2, 1, 1, 0x80, 0 };
+	wmm.insert(wmm.end(), 16, 0x27);
+	put_ie(&ies, 221, wmm);
+	bytes wps = wps_ie();
+	ies.insert(ies.end(), wps.begin(), wps.end());
+
+	return ies;
+}
+
+static bytes typical_ies(int i) {
+	char ssid[32];
+	snprintf(ssid, sizeof(ssid), "network-%d", i);
+
+	bytes ies = ssid_ie(ssid);
+	bytes rsn = rsn_ie(1 + i % 3);
+	ies.insert(ies.end(), rsn.begin(), rsn.end());
+	if (i % 4 == 0) {
+		bytes wpa = wpa_ie();
+		ies.insert(ies.end(), wpa.begin(), wpa.end());
+	}
+	if (i % 8 == 0) {
+		bytes wps = wps_ie();
+		ies.insert(ies.end(), wps.begin(), wps.end());
+	}
+	return ies;
+}
+
+// Micro-benchmark of decode_ies() over one blob of elements
+static void bench_decode(const char* name, const bytes& ies) {
+	struct bss_ies decoded;
+	long iterations = 0;
+	long long start = monotonic_ns();
+	long long elapsed;
+	unsigned long allocs = allocations;
+
+	do {
+		for (int i = 0; i < 1000; i++) {
+			decode_ies(ies.data(), ies.size(), &decoded);
+			sink = decoded.rsn.fields + decoded.wps.fields;
+		}
+		iterations += 1000;
+		elapsed = monotonic_ns() - start;
+	} while (elapsed < MIN_BENCH_NS);
+
+	report(name, iterations, elapsed, (unsigned long long)ies.size() * iterations,
+		(double)(allocations - allocs) / iterations);
+}
+
+// Synthetic NL80211_CMD_NEW_SCAN_RESULTS dump messages
+
+static struct nl_msg* bss_message(int i, unsigned int seq, int if_index) {
+	struct nl_msg* msg = nlmsg_alloc_size(8192);
+	unsigned char bssid[6] = { 0x02, 0x00, 0x00, (unsigned char)(i >> 16),
+		(unsigned char)(i >> 8), (unsigned char)i };
+	bytes ies = i % 10 == 0 ? vendor_heavy_ies() : typical_ies(i);
+
+	genlmsg_put(msg, 0, seq, NL80211_FAMILY_ID, 0, NLM_F_MULTI, NL80211_CMD_NEW_SCAN_RESULTS, 0);
+	nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index);
+	struct nlattr* bss = nla_nest_start(msg, NL80211_ATTR_BSS);
+	nla_put(msg, NL80211_BSS_BSSID, 6, bssid);
+	nla_put_u32(msg, NL80211_BSS_FREQUENCY, i % 2 ? 2412 + 5 * (i % 13) : 5180 + 20 * (i % 8));
+	nla_put_u16(msg, NL80211_BSS_CAPABILITY, 0x1511);
+	nla_put_u32(msg, NL80211_BSS_SIGNAL_MBM, (__u32)(-3000 - 100 * (i % 60)));
+	nla_put_u32(msg, NL80211_BSS_SEEN_MS_AGO, 100);
+	nla_put(msg, NL80211_BSS_INFORMATION_ELEMENTS, ies.size(), ies.data());
+	nla_put(msg, NL80211_BSS_BEACON_IES, ies.size(), ies.data());
+	nla_nest_end(msg, bss);
+
+	return msg;
+}
+
+static void bench_parse(const char* name, int nbss) {
+	std::vector<struct nl_msg*> msgs;
+	unsigned long long total_bytes = 0;
+	struct bss_record bss;
+
+	for (int i = 0; i < nbss; i++) {
+		msgs.push_back(bss_message(i, 1, 1));
+		total_bytes += nlmsg_hdr(msgs.back())->nlmsg_len;
+	}
+
+	long iterations = 0;
+	unsigned long long bytes = 0;
+	long long start = monotonic_ns();
+	long long elapsed;
+	unsigned long allocs = allocations;
+
+	do {
+		for (int i = 0; i < nbss; i++) {
+			if (decode_scan_result(nlmsg_hdr(msgs[i]), &bss) == 0)
+				sink = bss.elements.rsn.fields;
+		}
+		iterations += nbss;
+		bytes += total_bytes;
+		elapsed = monotonic_ns() - start;
+	} while (elapsed < MIN_BENCH_NS);
+
+	report(name, iterations, elapsed, bytes, (double)(allocations - allocs) / iterations);
+
+	for (auto msg : msgs)
+		nlmsg_free(msg);
+}
+
+// Writes a recording in the format of scan_record_open() with dumps dumps of nbss
+// BSSes each, returns the number of message bytes in it
+static unsigned long long write_recording(const char* path, int nbss, int dumps) {
+	FILE* file = fopen(path, "wb");
+	unsigned long long total_bytes = 0;
+
+	if (file == NULL) {
+		fprintf(stderr, "error opening %s: %d, %s\n", path, errno, strerror(errno));
+		exit(1);
+	}
+
+	auto put_record = [&](__u16 type, const void* data, __u32 len) {
+		static const char padding[8] = { 0 };
+		__u64 time_ns = 0;
+		__u16 reserved = 0;
+
+		fwrite(&time_ns, sizeof(time_ns), 1, file);
+		fwrite(&len, sizeof(len), 1, file);
+		fwrite(&type, sizeof(type), 1, file);
+		fwrite(&reserved, sizeof(reserved), 1, file);
+		fwrite(data, len, 1, file);
+		fwrite(padding, (8 - len % 8) % 8, 1, file);
+	};
+
+	const char magic[8] = { 'A', 'P', 'S', 'C', 'A', 'N', 'R', 'C' };
+	__u32 version = 1, reserved = 0;
+	__u64 start_ns = 0;
+	fwrite(magic, sizeof(magic), 1, file);
+	fwrite(&version, sizeof(version), 1, file);
+	fwrite(&reserved, sizeof(reserved), 1, file);
+	fwrite(&start_ns, sizeof(start_ns), 1, file);
+
+	char target[sizeof(__u32) + IF_NAMESIZE] = { 0 };
+	__u32 if_index = 1;
+	memcpy(target, &if_index, sizeof(if_index));
+	strcpy(target + sizeof(if_index), "bench0");
+	put_record(1, target, sizeof(target));
+
+	for (int d = 0; d < dumps; d++) {
+		for (int i = 0; i < nbss; i++) {
+			struct nl_msg* msg = bss_message(i, d + 1, if_index);
+			put_record(2, nlmsg_hdr(msg), nlmsg_hdr(msg)->nlmsg_len);
+			total_bytes += nlmsg_hdr(msg)->nlmsg_len;
+			nlmsg_free(msg);
+		}
+
+		struct nl_msg* done = nlmsg_alloc();
+		nlmsg_put(done, 0, d + 1, NLMSG_DONE, sizeof(int), NLM_F_MULTI);
+		put_record(2, nlmsg_hdr(done), nlmsg_hdr(done)->nlmsg_len);
+		nlmsg_free(done);
+	}
+
+	fclose(file);
+	return total_bytes;
+}
+
+struct dump_count {
+	long bss;
+	long first_dump;		// BSSes of the first dump, all of them are new
+	unsigned long warm_allocs;	// allocations once the first dump was reported
+};
+
+static void count_bss(const struct bss_record* bss, void* arg) {
+	struct dump_count* count = (struct dump_count*)arg;
+
+	if (++count->bss == count->first_dump)
+		count->warm_allocs = allocations;
+	sink = bss->elements.rsn.fields;
+}
+
+// End-to-end: the dumps of a recording go through the same dump handling as a live
+// scan, from the netlink message to the bss callback. Returns the allocations per
+// BSS after the first dump.
+static double bench_dump(const char* name, const char* path, int nbss, int dumps,
+	unsigned long long total_bytes, bool use_ie_cache, int diff_hysteresis) {
+
+	struct scan_ctx ctx;
+	struct dump_count count;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(&count, 0, sizeof(count));
+	count.first_dump = nbss;
+	ctx.diff_hysteresis = diff_hysteresis;
+	ctx.use_ie_cache = use_ie_cache;
+	ctx.bss_cb = count_bss;
+	ctx.bss_cb_arg = &count;
+
+	unsigned long allocs = allocations;
+	long long start = monotonic_ns();
+	int err = do_replay(&ctx, path, false);
+	long long elapsed = monotonic_ns() - start;
+	if (dumps > 1)
+		allocs = allocations - count.warm_allocs;
+	else
+		allocs = allocations - allocs;
+	scan_ctx_free(&ctx);
+
+	if (err != 0) {
+		fprintf(stderr, "%s: replay failed with %d\n", name, err);
+		exit(1);
+	}
+
+	double allocs_per_bss = (double)allocs / (dumps > 1 ? (long)nbss * (dumps - 1) : nbss);
+	report(name, (long)nbss * dumps, elapsed, total_bytes, allocs_per_bss);
+	return allocs_per_bss;
+}
+
+static void usage(const char* progname) {
+	printf("usage: %s [options]\n\n"
+		"options:\n"
+		"  -n, --bss <n>        BSSes per dump in the end-to-end benchmarks (default: %d)\n"
+		"  -d, --dumps <n>      dumps in the end-to-end benchmarks (default: %d)\n"
+		"  -f, --filter <text>  only run the benchmarks whose name contains <text>\n"
+		"  -c, --check          fail if dump/plain or dump/ie-cache allocate after the first dump\n"
+		"                       or if the RSN decoder drops suites\n"
+		"  -h, --help           print this help\n",
+		progname, DEFAULT_BSS_COUNT, DEFAULT_DUMPS);
+}
+
+int main(int argc, char** argv) {
+
+	int nbss = DEFAULT_BSS_COUNT;
+	int dumps = DEFAULT_DUMPS;
+	const char* filter = "";
+	bool check = false;
+
+	static const struct option long_options[] = {
+		{ "bss", required_argument, NULL, 'n' },
+		{ "dumps", required_argument, NULL, 'd' },
+		{ "filter", required_argument, NULL, 'f' },
+		{ "check", no_argument, NULL, 'c' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "n:d:f:ch", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			nbss = atoi(optarg);
+			break;
+		case 'd':
+			dumps = atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'c':
+			check = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// --check needs a dump after the first one
+	if (nbss <= 0 || nbss > 0xffffff || dumps <= 0 || (check && dumps < 2)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	auto enabled = [&](const char* name) { return strstr(name, filter) != NULL; };
+	int failed = 0;
+
+	if (check) {
+		struct bss_ies decoded;
+		bytes rsn = rsn_ie(24);
+
+		decode_ies(rsn.data(), rsn.size(), &decoded);
+		if (decoded.rsn.npairwise != 24 || decoded.rsn.nakm != 24) {
+			fprintf(stderr, "decode_rsn keeps %d of 24 pairwise and %d of 24 AKM suites\n",
+				decoded.rsn.npairwise, decoded.rsn.nakm);
+			failed++;
+		}
+	}
+
+	// more suites than the decoder once kept
+	static const int suite_counts[] = { 1, 4, 16, 24 };
+	for (int n : suite_counts) {
+		char name[64];
+		snprintf(name, sizeof(name), "decode_rsn/%d-suites", n);
+		if (enabled(name))
+			bench_decode(name, rsn_ie(n));
+	}
+
+	if (enabled("decode_wps/long"))
+		bench_decode("decode_wps/long", wps_ie());
+	if (enabled("decode_ies/vendor-heavy"))
+		bench_decode("decode_ies/vendor-heavy", vendor_heavy_ies());
+	if (enabled("decode_ies/typical"))
+		bench_decode("decode_ies/typical", typical_ies(0));
+	if (enabled("decode_scan_result"))
+		bench_parse("decode_scan_result", nbss);
+
+	if (enabled("dump/")) {
+		char path[] = "/tmp/ap-scanner-bench-XXXXXX";
+		int fd = mkstemp(path);
+		if (fd < 0) {
+			fprintf(stderr, "error creating a temporary file: %d, %s\n", errno, strerror(errno));
+			return 1;
+		}
+		close(fd);
+
+		unsigned long long total_bytes = write_recording(path, nbss, dumps);
+
+		// the steady state of these two has nothing to allocate
+		if (enabled("dump/plain") &&
+			bench_dump("dump/plain", path, nbss, dumps, total_bytes, false, -1) > 0 && check) {
+			fprintf(stderr, "dump/plain allocates after the first dump\n");
+			failed++;
+		}
+		if (enabled("dump/ie-cache") &&
+			bench_dump("dump/ie-cache", path, nbss, dumps, total_bytes, true, -1) > 0 && check) {
+			fprintf(stderr, "dump/ie-cache allocates after the first dump\n");
+			failed++;
+		}
+		if (enabled("dump/diff"))
+			bench_dump("dump/diff", path, nbss, dumps, total_bytes, true, 300);
+
+		unlink(path);
+	}
+
+	return failed > 0 ? 1 : 0;
+}
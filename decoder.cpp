@@ -0,0 +1,690 @@
+/**
+ * Code applied from:
+ * - libnl sources LGPL2.1 https://www.infradead.org/~tgr/libnl/
+ * - example code from Python libnl port (LGPL2.1):
+ *	 https://github.com/Robpol86/libnl/blob/master/example_c/scan_access_points.c
+ * - as well as iw(8) source code (MIT).
+ *   https://git.sipsolutions.net/iw.git/tree/scan.c
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Decoding of NL80211_CMD_GET_SCAN results into struct bss_record. Information
+// element parsing is based entirely on iw source code. There's a ton of undocumented
+// magic values going around, and I didn't really get an understanding how IE is
+// bundled into scan responses, but it seems to be binary data of custom structure.
+
+#include <stddef.h>
+#include <string.h>
+#include <netlink/genl/genl.h>
+
+#include "apscanner.h"
+
+const unsigned char ms_oui[3] = { 0x00, 0x50, 0xf2 };
+
+const __u32 MS_OUI = 0x0050f2;
+const __u32 IEEE80211_OUI = 0x000fac;
+const __u32 WFA_OUI = 0x506f9a;
+
+// From http://git.kernel.org/cgit/linux/kernel/git/jberg/iw.git/tree/util.c
+void mac_addr_n2a(char* mac_addr, const unsigned char* arg) {
+
+	static const char digits[] = "0123456789abcdef";
+	int i, l;
+	l = 0;
+	for (i = 0; i < 6; i++) {
+		if (i != 0) {
+			mac_addr[l++] = ':';
+		}
+		mac_addr[l++] = digits[arg[i] >> 4];
+		mac_addr[l++] = digits[arg[i] & 0xf];
+	}
+	mac_addr[l] = '\0';
+}
+
+static __u32 suite(const __u8* data) {
+	return (__u32)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+// This is copied from iw sources, and I have no idea how this works
+// There's a lot of magic numbers going around.
+const char* akm_suite_name(__u32 suite) {
+
+	switch (suite >> 8) {
+	case MS_OUI:
+		switch (suite & 0xff) {
+		case 1:
+			return "IEEE 802.1X";
+		case 2:
+			return "PSK";
+		}
+		break;
+	case IEEE80211_OUI:
+		switch (suite & 0xff) {
+		case 1:
+			return "IEEE 802.1X";
+		case 2:
+			return "PSK";
+		case 3:
+			return "FT/IEEE 802.1X";
+		case 4:
+			return "FT/PSK";
+		case 5:
+			return "IEEE 802.1X/SHA-256";
+		case 6:
+			return "PSK/SHA-256";
+		case 7:
+			return "TDLS/TPK";
+		case 8:
+			return "SAE";
+		case 9:
+			return "FT/SAE";
+		case 11:
+			return "IEEE 802.1X/SUITE-B";
+		case 12:
+			return "IEEE 802.1X/SUITE-B-192";
+		case 13:
+			return "FT/IEEE 802.1X/SHA-384";
+		case 14:
+			return "FILS/SHA-256";
+		case 15:
+			return "FILS/SHA-384";
+		case 16:
+			return "FT/FILS/SHA-256";
+		case 17:
+			return "FT/FILS/SHA-384";
+		case 18:
+			return "OWE";
+		}
+		break;
+	case WFA_OUI:
+		switch (suite & 0xff) {
+		case 1:
+			return "OSEN";
+		case 2:
+			return "DPP";
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+// Copied from iw sources, no idea what the magic values are
+const char* cipher_suite_name(__u32 suite) {
+
+	switch (suite >> 8) {
+	case MS_OUI:
+		switch (suite & 0xff) {
+		case 0:
+			return "Use group cipher suite";
+		case 1:
+			return "WEP-40";
+		case 2:
+			return "TKIP";
+		case 4:
+			return "CCMP";
+		case 5:
+			return "WEP-104";
+		}
+		break;
+	case IEEE80211_OUI:
+		switch (suite & 0xff) {
+		case 0:
+			return "Use group cipher suite";
+		case 1:
+			return "WEP-40";
+		case 2:
+			return "TKIP";
+		case 4:
+			return "CCMP";
+		case 5:
+			return "WEP-104";
+		case 6:
+			return "AES-128-CMAC";
+		case 7:
+			return "NO-GROUP";
+		case 8:
+			return "GCMP";
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+// from iw source code, no idea what's going on here
+static void decode_rsn(__u32 defcipher, __u32 defauth, __u8 len, const __u8* data,
+	struct rsn_info* rsn) {
+
+	__u16 count;
+	int i;
+
+	rsn->version = data[0] + (data[1] << 8);
+	data += 2;
+	len -= 2;
+
+	if (len < 4) {
+		rsn->fields |= RSN_GROUP_CIPHER | RSN_PAIRWISE;
+		rsn->group_cipher = defcipher;
+		rsn->pairwise[rsn->npairwise++] = defcipher;
+		return;
+	}
+
+	rsn->fields |= RSN_GROUP_CIPHER;
+	rsn->group_cipher = suite(data);
+	data += 4;
+	len -= 4;
+
+	if (len < 2) {
+		rsn->fields |= RSN_PAIRWISE;
+		rsn->pairwise[rsn->npairwise++] = defcipher;
+		return;
+	}
+
+	count = data[0] | (data[1] << 8);
+	if (2 + (count * 4) > len) {
+		goto invalid;
+	}
+
+	rsn->fields |= RSN_PAIRWISE;
+	for (i = 0; i < count && i < MAX_IE_SUITES; i++) {
+		rsn->pairwise[rsn->npairwise++] = suite(data + 2 + (i * 4));
+	}
+
+	data += 2 + (count * 4);
+	len -= 2 + (count * 4);
+
+	if (len < 2) {
+		rsn->fields |= RSN_AKM;
+		rsn->akm[rsn->nakm++] = defauth;
+		return;
+	}
+
+	count = data[0] | (data[1] << 8);
+	if (2 + (count * 4) > len) {
+		goto invalid;
+	}
+
+	rsn->fields |= RSN_AKM;
+	for (i = 0; i < count && i < MAX_IE_SUITES; i++) {
+		rsn->akm[rsn->nakm++] = suite(data + 2 + (i * 4));
+	}
+
+	data += 2 + (count * 4);
+	len -= 2 + (count * 4);
+
+	if (len >= 2) {
+		rsn->fields |= RSN_CAPABILITIES;
+		rsn->capabilities = data[0] | (data[1] << 8);
+		data += 2;
+		len -= 2;
+	}
+
+	if (len >= 2) {
+		int pmkid_count = data[0] | (data[1] << 8);
+
+		if (len >= 2 + 16 * pmkid_count) {
+			rsn->fields |= RSN_PMKID_COUNT;
+			rsn->pmkid_count = pmkid_count;
+			/* not decoding PMKID values */
+			data += 2 + 16 * pmkid_count;
+			len -= 2 + 16 * pmkid_count;
+		} else {
+			goto invalid;
+		}
+	}
+
+	if (len >= 4) {
+		rsn->fields |= RSN_GROUP_MGMT_CIPHER;
+		rsn->group_mgmt_cipher = suite(data);
+		data += 4;
+		len -= 4;
+	}
+
+invalid:
+	if (len != 0) {
+		rsn->tail_len = len;
+		memcpy(rsn->tail, data, len);
+	}
+}
+
+// Copies a WPS string attribute, cut at the first NUL byte like printf("%.*s") does
+static void wps_string(char* dst, size_t size, const __u8* data, __u16 len) {
+	size_t n = len < size - 1 ? len : size - 1;
+
+	memcpy(dst, data, n);
+	dst[n] = '\0';
+}
+
+static void decode_wifi_wps(__u8 len, const __u8* data, struct wps_info* wps) {
+
+	__u16 subtype, sublen;
+
+	while (len >= 4) {
+		subtype = (data[0] << 8) + data[1];
+		sublen = (data[2] << 8) + data[3];
+		if (sublen > len - 4)
+			break;
+
+		switch (subtype) {
+		case 0x104a:
+			if (sublen < 1) break;
+
+			wps->fields |= WPS_VERSION;
+			wps->version = data[4];
+			break;
+		case 0x1011:
+			wps->fields |= WPS_DEVICE_NAME;
+			wps_string(wps->device_name, sizeof(wps->device_name), data + 4, sublen);
+			break;
+		case 0x1012:
+			if (sublen != 2) break;
+
+			wps->fields |= WPS_PASSWORD_ID;
+			wps->password_id = data[4] << 8 | data[5];
+			break;
+		case 0x1021:
+			wps->fields |= WPS_MANUFACTURER;
+			wps_string(wps->manufacturer, sizeof(wps->manufacturer), data + 4, sublen);
+			break;
+		case 0x1023:
+			wps->fields |= WPS_MODEL;
+			wps_string(wps->model, sizeof(wps->model), data + 4, sublen);
+			break;
+		case 0x1024:
+			wps->fields |= WPS_MODEL_NUMBER;
+			wps_string(wps->model_number, sizeof(wps->model_number), data + 4, sublen);
+			break;
+		case 0x103b:
+			if (sublen < 1) break;
+
+			wps->fields |= WPS_RESPONSE_TYPE;
+			wps->response_type = data[4];
+			break;
+		case 0x103c:
+			if (sublen < 1) break;
+
+			wps->fields |= WPS_RF_BANDS;
+			wps->rf_bands = data[4];
+			break;
+		case 0x1041:
+			if (sublen < 1) break;
+
+			wps->fields |= WPS_SELECTED_REGISTRAR;
+			wps->selected_registrar = data[4];
+			break;
+		case 0x1042:
+			wps->fields |= WPS_SERIAL_NUMBER;
+			wps_string(wps->serial_number, sizeof(wps->serial_number), data + 4, sublen);
+			break;
+		case 0x1044:
+			if (sublen < 1) break;
+
+			wps->fields |= WPS_STATE;
+			wps->state = data[4];
+			break;
+		case 0x1047:
+			if (sublen != 16) break;
+
+			wps->fields |= WPS_UUID;
+			memcpy(wps->uuid, data + 4, 16);
+			break;
+		case 0x1049:
+			if (sublen == 6 &&
+			    data[4] == 0x00 &&
+			    data[5] == 0x37 &&
+			    data[6] == 0x2a &&
+			    data[7] == 0x00 &&
+			    data[8] == 0x01) {
+				wps->fields |= WPS_VERSION2;
+				wps->version2 = data[9];
+			}
+			break;
+		case 0x1054:
+			if (sublen != 8) break;
+
+			wps->fields |= WPS_DEVICE_TYPE;
+			wps->device_category = data[4] << 8 | data[5];
+			memcpy(wps->device_oui, data + 6, 4);
+			wps->device_subcategory = data[10] << 8 | data[11];
+			break;
+		case 0x1057:
+			if (sublen < 1) break;
+
+			wps->fields |= WPS_AP_SETUP_LOCKED;
+			wps->ap_setup_locked = data[4];
+			break;
+		case 0x1008:
+			if (sublen < 2) break;
+
+			wps->fields |= WPS_CONFIG_METHODS;
+			wps->config_methods = (data[4] << 8) + data[5];
+			break;
+		case 0x1053:
+			if (sublen < 2) break;
+
+			wps->fields |= WPS_SR_CONFIG_METHODS;
+			wps->sr_config_methods = (data[4] << 8) + data[5];
+			break;
+		default:
+			break;
+		}
+
+		data += sublen + 4;
+		len -= sublen + 4;
+	}
+}
+
+// Checks the length of an element against the range its decoder accepts. An
+// element that is out of range is kept as invalid.
+static bool ie_check(struct ie_state* ie, __u8 len, const __u8* data, __u8 minlen, __u8 maxlen) {
+	ie->len = len;
+	if (len < minlen || len > maxlen) {
+		ie->status = IE_INVALID;
+		ie->first = len ? data[0] : 0;
+		return false;
+	}
+
+	ie->status = IE_PRESENT;
+	return true;
+}
+
+static void decode_vendor(__u8 len, const __u8* data, struct bss_ies* ies, unsigned int kinds) {
+
+	if (len < 4 || memcmp(data, ms_oui, 3) != 0) {
+		return;
+	}
+
+	switch (data[3]) {
+	case 1:
+		if ((kinds & DECODE_WPA) && ies->wpa.ie.status == IE_ABSENT &&
+			ie_check(&ies->wpa.ie, len - 4, data + 4, 2, 255))
+			decode_rsn(MS_OUI << 8 | 2, MS_OUI << 8 | 1, len - 4, data + 4, &ies->wpa);
+		break;
+	case 4:
+		if ((kinds & DECODE_WPS) && ies->wps.ie.status == IE_ABSENT &&
+			ie_check(&ies->wps.ie, len - 4, data + 4, 0, 255))
+			decode_wifi_wps(len - 4, data + 4, &ies->wps);
+		break;
+	}
+}
+
+// Go through all information elements and decode the ones there is a decoder for
+void decode_ies(const __u8* ie, int ielen, struct bss_ies* ies, unsigned int kinds) {
+
+	memset(ies, 0, sizeof(*ies));
+
+	if (ie == NULL || ielen < 0) {
+		return;
+	}
+
+	while (ielen >= 2 && ielen - 2 >= ie[1]) {
+		__u8 len = ie[1];
+		const __u8* data = ie + 2;
+
+		switch (ie[0]) {
+		case 0:
+			if ((kinds & DECODE_SSID) && ies->ssid.ie.status == IE_ABSENT &&
+				ie_check(&ies->ssid.ie, len, data, 0, 32)) {
+				ies->ssid.len = len;
+				memcpy(ies->ssid.data, data, len);
+			}
+			break;
+		case 48:
+			if ((kinds & DECODE_RSN) && ies->rsn.ie.status == IE_ABSENT &&
+				ie_check(&ies->rsn.ie, len, data, 2, 255))
+				decode_rsn(IEEE80211_OUI << 8 | 4, IEEE80211_OUI << 8 | 1, len, data, &ies->rsn);
+			break;
+		case 221:
+			if (kinds & (DECODE_WPA | DECODE_WPS))
+				decode_vendor(len, data, ies, kinds);
+			break;
+		}
+
+		ielen -= ie[1] + 2;
+		ie += ie[1] + 2;
+	}
+}
+
+// FNV-1a, used to notice changed information elements
+const __u64 HASH_INIT = 0xcbf29ce484222325ULL;
+
+static __u64 hash_bytes(__u64 hash, const unsigned char* data, int len) {
+	for (int i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+__u64 hash_bss_ies(const struct bss_record* bss) {
+	__u64 hash = HASH_INIT;
+
+	if (bss->ies)
+		hash = hash_bytes(hash, bss->ies, bss->ies_len);
+	// a beacon with the same elements as the last frame adds nothing
+	if (bss->beacon_ies && (bss->ies_len != bss->beacon_ies_len ||
+		memcmp(bss->ies, bss->beacon_ies, bss->ies_len)))
+		hash = hash_bytes(hash, bss->beacon_ies, bss->beacon_ies_len);
+	return hash;
+}
+
+const __u8* find_ie(const __u8* ie, int ielen, __u8 id) {
+
+	if (ie == NULL)
+		return NULL;
+
+	while (ielen >= 2 && ielen - 2 >= ie[1]) {
+		if (ie[0] == id)
+			return ie;
+		ielen -= ie[1] + 2;
+		ie += ie[1] + 2;
+	}
+
+	return NULL;
+}
+
+static unsigned int akm_security(__u32 akm) {
+
+	if (akm == (MS_OUI << 8 | 1))
+		return SCAN_SECURITY_EAP;
+	if (akm == (MS_OUI << 8 | 2))
+		return SCAN_SECURITY_PSK;
+	if (akm >> 8 != IEEE80211_OUI)
+		return 0;
+
+	switch (akm & 0xff) {
+	case 1: case 3: case 5: case 11: case 12: case 13:
+	case 14: case 15: case 16: case 17:
+		return SCAN_SECURITY_EAP;
+	case 2: case 4: case 6:
+		return SCAN_SECURITY_PSK;
+	case 8: case 9: case 24: case 25:
+		return SCAN_SECURITY_SAE;
+	case 18:
+		return SCAN_SECURITY_OWE;
+	}
+
+	return 0;
+}
+
+// The AKM suites of an RSN or WPA element like decode_rsn() finds them, without
+// decoding the rest
+static unsigned int rsn_security(__u32 defauth, __u8 len, const __u8* data) {
+
+	// version, group cipher, then the pairwise ciphers and the AKM suites
+	if (len < 2 + 4 + 2)
+		return akm_security(defauth);
+
+	int offset = 2 + 4 + 2 + 4 * (data[6] | (data[7] << 8));
+	if (offset > len)
+		return 0;
+	if (offset + 2 > len)
+		return akm_security(defauth);
+
+	int count = data[offset] | (data[offset + 1] << 8);
+	if (offset + 2 + count * 4 > len)
+		return 0;
+
+	unsigned int security = 0;
+	for (int i = 0; i < count; i++)
+		security |= akm_security(suite(data + offset + 2 + i * 4));
+	return security;
+}
+
+unsigned int bss_security(const struct bss_record* bss) {
+
+	unsigned int security = 0;
+	bool rsn = false;
+	const __u8* ie = bss->ies;
+	int ielen = ie ? bss->ies_len : 0;
+
+	while (ielen >= 2 && ielen - 2 >= ie[1]) {
+		__u8 len = ie[1];
+		const __u8* data = ie + 2;
+
+		if (ie[0] == 48 && len >= 2) {
+			rsn = true;
+			security |= rsn_security(IEEE80211_OUI << 8 | 1, len, data);
+		} else if (ie[0] == 221 && len >= 6 && memcmp(data, ms_oui, 3) == 0 && data[3] == 1) {
+			rsn = true;
+			security |= rsn_security(MS_OUI << 8 | 1, len - 4, data + 4);
+		}
+
+		ielen -= ie[1] + 2;
+		ie += ie[1] + 2;
+	}
+
+	if (rsn)
+		return security;
+
+	// capability bit 4, privacy
+	return bss->has_capability && (bss->capability & 0x10) ? SCAN_SECURITY_WEP : SCAN_SECURITY_OPEN;
+}
+
+// Types of the attributes nested in NL80211_ATTR_BSS, used by nla_parse_nested() to
+// check the length of each attribute before it is read. Built once.
+struct bss_policy {
+	struct nla_policy attrs[NL80211_BSS_MAX + 1];
+
+	bss_policy() {
+		memset(attrs, 0, sizeof(attrs));
+		attrs[NL80211_BSS_TSF].type = NLA_U64;
+		attrs[NL80211_BSS_FREQUENCY].type = NLA_U32;
+		attrs[NL80211_BSS_FREQUENCY_OFFSET].type = NLA_U32;
+		attrs[NL80211_BSS_BEACON_INTERVAL].type = NLA_U16;
+		attrs[NL80211_BSS_CAPABILITY].type = NLA_U16;
+		attrs[NL80211_BSS_SIGNAL_MBM].type = NLA_U32;
+		attrs[NL80211_BSS_SIGNAL_UNSPEC].type = NLA_U8;
+		attrs[NL80211_BSS_STATUS].type = NLA_U32;
+		attrs[NL80211_BSS_SEEN_MS_AGO].type = NLA_U32;
+	}
+};
+
+static const struct bss_policy bss_policy;
+
+// Works on the message in place: the record points into the message, nothing is
+// copied or allocated.
+int parse_scan_result(struct nlmsghdr* hdr, struct bss_record* bss) {
+
+	// everything in front of the decoded elements, those are filled in (and
+	// cleared) by decode_bss_ies()
+	memset(bss, 0, offsetof(struct bss_record, elements));
+	bss->beacon_differs = false;
+
+	if (!genlmsg_valid_hdr(hdr, 0)) {
+		return -NLE_MSG_TOOSHORT;
+	}
+
+	struct genlmsghdr* gnlh = (genlmsghdr*)nlmsg_data(hdr);
+
+	// The BSS is a nested attribute of the message. Only that one is needed, so it
+	// is looked up instead of parsing all NL80211_ATTR_MAX attributes of the message.
+	struct nlattr* bss_attr = nla_find(genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NL80211_ATTR_BSS);
+	if (!bss_attr) {
+		return -NLE_MISSING_ATTR;
+	}
+
+	// container for parsing the access point's basic service set information (BSS)
+	struct nlattr* attrs[NL80211_BSS_MAX + 1];
+
+	int err = nla_parse_nested(attrs, NL80211_BSS_MAX, bss_attr, bss_policy.attrs);
+	if (err < 0) {
+		return err;
+	}
+
+	// If BSSID or IE is missing, we can't parse anything beyond this point
+	if (!attrs[NL80211_BSS_BSSID] || nla_len(attrs[NL80211_BSS_BSSID]) < 6 ||
+		!attrs[NL80211_BSS_INFORMATION_ELEMENTS]) {
+		return -NLE_MISSING_ATTR;
+	}
+
+	memcpy(bss->bssid, nla_data(attrs[NL80211_BSS_BSSID]), sizeof(bss->bssid));
+
+	if (attrs[NL80211_BSS_SIGNAL_MBM]) {
+		bss->has_signal_mbm = true;
+		bss->signal_mbm = (int)nla_get_u32(attrs[NL80211_BSS_SIGNAL_MBM]);
+	}
+	if (attrs[NL80211_BSS_SIGNAL_UNSPEC]) {
+		bss->has_signal_unspec = true;
+		bss->signal_unspec = nla_get_u8(attrs[NL80211_BSS_SIGNAL_UNSPEC]);
+	}
+	if (attrs[NL80211_BSS_FREQUENCY])
+		bss->freq = nla_get_u32(attrs[NL80211_BSS_FREQUENCY]);
+	if (attrs[NL80211_BSS_FREQUENCY_OFFSET])
+		bss->freq_offset = nla_get_u32(attrs[NL80211_BSS_FREQUENCY_OFFSET]);
+	if (attrs[NL80211_BSS_CAPABILITY]) {
+		bss->has_capability = true;
+		bss->capability = nla_get_u16(attrs[NL80211_BSS_CAPABILITY]);
+	}
+	if (attrs[NL80211_BSS_SEEN_MS_AGO]) {
+		bss->has_seen_ms_ago = true;
+		bss->seen_ms_ago = nla_get_u32(attrs[NL80211_BSS_SEEN_MS_AGO]);
+	}
+
+	bss->ies = (const __u8*)nla_data(attrs[NL80211_BSS_INFORMATION_ELEMENTS]);
+	bss->ies_len = nla_len(attrs[NL80211_BSS_INFORMATION_ELEMENTS]);
+	if (attrs[NL80211_BSS_BEACON_IES]) {
+		bss->beacon_ies = (const __u8*)nla_data(attrs[NL80211_BSS_BEACON_IES]);
+		bss->beacon_ies_len = nla_len(attrs[NL80211_BSS_BEACON_IES]);
+	}
+
+	return 0;
+}
+
+void decode_bss_ies(struct bss_record* bss, unsigned int kinds) {
+
+	decode_ies(bss->ies, bss->ies_len, &bss->elements, kinds);
+
+	// The kernel reports the elements of the last frame received from the BSS and,
+	// separately, those of its last beacon. Most of the time both are the same blob,
+	// which is decoded only once.
+	bss->beacon_differs = bss->beacon_ies && (bss->ies_len != bss->beacon_ies_len ||
+		memcmp(bss->ies, bss->beacon_ies, bss->ies_len));
+
+	if (bss->beacon_differs)
+		decode_ies(bss->beacon_ies, bss->beacon_ies_len, &bss->beacon, kinds);
+}
+
+int decode_scan_result(struct nlmsghdr* hdr, struct bss_record* bss) {
+
+	int err = parse_scan_result(hdr, bss);
+	if (err < 0)
+		return err;
+
+	decode_bss_ies(bss);
+	return 0;
+}
@@ -36,14 +36,19 @@
 
 #include <errno.h>
 #include <ctype.h>
-#include <netlink/genl/genl.h>
-#include <netlink/genl/ctrl.h>
-#include <linux/nl80211.h>
-#include <net/if.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <memory>
 #include <stdio.h>
 
-#define ARRAY_SIZE(ar) (sizeof(ar)/sizeof(ar[0]))
+#include "apscanner.h"
+#include "server.h"
 
 // These are from iw source code, and they related to parsing BSS capabilities
 #define WLAN_CAPABILITY_ESS                 (1<<0)
@@ -78,126 +83,409 @@
 #define WLAN_CAPABILITY_DMG_SPECTRUM_MGMT   (1<<8)
 #define WLAN_CAPABILITY_DMG_RADIO_MEASURE   (1<<12)
 
-// These are from iw source code, and they related to parsing authentication suites
-const unsigned char ms_oui[3] = { 0x00, 0x50, 0xf2 };
-const unsigned char ieee80211_oui[3]   = { 0x00, 0x0f, 0xac };
-const unsigned char wfa_oui[3] = { 0x50, 0x6f, 0x9a };
-
 // global variable that contains the MAC address for the current scan result,
 // used to make sure every print contains clarification for which MAC the data is.
 char current_mac[20];
+static unsigned char current_bssid[6];
+
+// the query server of --serve, NULL without it
+static struct query_server* server = NULL;
+
+// Source tag ("presp" or "beacon") appended to the section name of information
+// elements that differ between the probe response and the beacon of a BSS.
+static const char* current_source = NULL;
 
 const char* DISCOVER_STR = "AP_DISCOVERED,";
 const char* DATA_STR = "AP_DATA,";
 const char* BSS_SECTION = "BSS";
 
-inline void dataline(const char* section_name = NULL) {
-	printf("%s%s,%s,", DATA_STR, current_mac, section_name != NULL ? section_name : BSS_SECTION);
+// line prefixes of --diff mode
+const char* NEW_STR = "AP_NEW,";
+const char* CHANGED_STR = "AP_CHANGED,";
+const char* GONE_STR = "AP_GONE,";
+
+// Every record (one BSS, or one AP_GONE) is rendered into this buffer and written
+// to stdout with a single write() by out_flush(). A slow consumer never sees a torn
+// record, and the printers don't pay for stdio locking and format parsing per field.
+struct out_buffer {
+	char* data;
+	size_t len;
+	size_t size;
+};
+
+const size_t OUT_BUFFER_SIZE = 64 * 1024;
+
+static struct out_buffer out = { NULL, 0, 0 };
+
+// Makes room for n more bytes, returns false if the buffer can't grow
+static bool out_reserve(size_t n) {
+	if (out.len + n <= out.size)
+		return true;
+
+	size_t size = out.size ? out.size : OUT_BUFFER_SIZE;
+	while (size < out.len + n)
+		size *= 2;
+
+	char* data = (char*)realloc(out.data, size);
+	if (data == NULL)
+		return false;
+
+	out.data = data;
+	out.size = size;
+	return true;
 }
 
-static void sep_if_not_first(bool *first, const char* separator = ",")
-{
-	if (!*first)
-		printf("%s", separator);
-	else
-		*first = false;
+static void out_write(const char* s, size_t n) {
+	if (!out_reserve(n))
+		return;
+
+	memcpy(out.data + out.len, s, n);
+	out.len += n;
 }
 
-struct init_scan_results {
-	int done;
-	int aborted;
-};
+static void out_str(const char* s) {
+	out_write(s, strlen(s));
+}
+
+static void out_char(char c) {
+	if (out_reserve(1))
+		out.data[out.len++] = c;
+}
+
+static void out_uint(unsigned long v) {
+	char buf[24];
+	char* p = buf + sizeof(buf);
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	out_write(p, buf + sizeof(buf) - p);
+}
+
+static void out_int(long v) {
+	if (v < 0) {
+		out_char('-');
+		out_uint(-(unsigned long)v);
+	} else {
+		out_uint(v);
+	}
+}
+
+// Lowercase hex, zero padded to at least width digits
+static void out_hex(unsigned long v, int width) {
+	static const char digits[] = "0123456789abcdef";
+	char buf[24];
+	char* p = buf + sizeof(buf);
+
+	do {
+		*--p = digits[v & 0xf];
+		v >>= 4;
+	} while (v || buf + sizeof(buf) - p < width);
+
+	out_write(p, buf + sizeof(buf) - p);
+}
 
-struct print_ies_data {
-	unsigned char *ie;
-	int ielen;
+// Output formats, see the README for the JSON and TLV layouts. All of them carry
+// the same section, key and value strings as the text format.
+enum output_format {
+	FORMAT_TEXT,
+	FORMAT_JSON,
+	FORMAT_TLV,
 };
 
-// Error callback
-int error_handler(struct sockaddr_nl* nla, struct nlmsgerr* err, void* arg) {
-	int* ret = (int*)arg;
-	*ret = err->error;
-	return NL_STOP;
+static int out_format = FORMAT_TEXT;
+
+// Records are written here. With a structured format stdout is moved to stderr so
+// that progress and error messages can't end up in the middle of the records.
+static int out_fd = STDOUT_FILENO;
+
+// Where the current record, its data and field started in the output buffer
+static size_t record_header = 0;
+static size_t record_start = 0;
+static size_t field_start = 0;
+
+// Writes the buffered records out. Anything printed with stdio before is
+// flushed first so the order of the output is kept.
+static void out_flush() {
+	size_t done = 0;
+
+	fflush(stdout);
+	while (done < out.len) {
+		ssize_t n = write(out_fd, out.data + done, out.len - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+
+	out.len = 0;
 }
 
-// Callback for NL_CB_FINISH
-int finish_handler(struct nl_msg* msg, void* arg) {
-	int* ret = (int*)arg;
-	*ret = 0;
-	return NL_SKIP;
+static void out_le(unsigned long v, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		out_char((char)(v >> (8 * i)));
 }
 
-// Callback for NL_CB_ACK
-int ack_handler(struct nl_msg *msg, void* arg) {
-	int* ret = (int*)arg;
-	*ret = 0;
-	return NL_STOP;
+// Overwrites bytes already in the buffer, used to fill in TLV lengths
+static void out_patch_le(size_t pos, unsigned long v, int bytes) {
+	for (int i = 0; i < bytes && pos + i < out.len; i++)
+		out.data[pos + i] = (char)(v >> (8 * i));
 }
 
-// Callback for NL_CB_SEQ_CHECK
-int no_seq_check(struct nl_msg* msg, void* arg) {
-	return NL_OK;
+static bool json_escaped(unsigned char c) {
+	return c == '"' || c == '\\' || c < 0x20 || c >= 0x7f;
 }
 
-// From http://git.kernel.org/cgit/linux/kernel/git/jberg/iw.git/tree/util.c
-void mac_addr_n2a(char* mac_addr, unsigned char* arg) {
+// Turns everything from start to the end of the buffer into the contents of a JSON
+// string. Bytes outside printable ASCII become \u00XX.
+static void out_json_escape(size_t start) {
+	static const char digits[] = "0123456789abcdef";
+	size_t extra = 0;
 
-	int i, l;
-	l = 0;
-	for (i = 0; i < 6; i++) {
-		if (i == 0) {
-			sprintf(mac_addr+l, "%02x", arg[i]);
-			l += 2;
+	for (size_t i = start; i < out.len; i++) {
+		unsigned char c = out.data[i];
+		if (c == '"' || c == '\\')
+			extra += 1;
+		else if (json_escaped(c))
+			extra += 5;
+	}
+
+	if (extra == 0)
+		return;
+
+	if (!out_reserve(extra)) {
+		out.len = start;
+		return;
+	}
+
+	size_t src = out.len;
+	size_t dst = out.len + extra;
+	out.len = dst;
+
+	while (src > start) {
+		unsigned char c = out.data[--src];
+		if (c == '"' || c == '\\') {
+			out.data[--dst] = c;
+			out.data[--dst] = '\\';
+		} else if (json_escaped(c)) {
+			out.data[--dst] = digits[c & 0xf];
+			out.data[--dst] = digits[c >> 4];
+			out.data[--dst] = '0';
+			out.data[--dst] = '0';
+			out.data[--dst] = 'u';
+			out.data[--dst] = '\\';
 		} else {
-			sprintf(mac_addr+l, ":%02x", arg[i]);
-			l += 3;
+			out.data[--dst] = c;
+		}
+	}
+}
+
+// Record types of the TLV format
+static int record_type(const char* header) {
+	if (header == NEW_STR)
+		return 2;
+	if (header == CHANGED_STR)
+		return 3;
+	if (header == GONE_STR)
+		return 4;
+	return 1;
+}
+
+// Starts a record: the AP_DISCOVERED (AP_NEW, ...) line of the current BSS
+static void record_begin(const char* header) {
+	record_header = out.len;
+	switch (out_format) {
+	case FORMAT_TEXT:
+		out_str(header);
+		out_str(current_mac);
+		out_char('\n');
+		break;
+	case FORMAT_JSON:
+		// the header without its trailing comma
+		out_str("{\"event\":\"");
+		out_write(header, strlen(header) - 1);
+		out_str("\",\"mac\":\"");
+		out_str(current_mac);
+		out_str("\",\"data\":[");
+		break;
+	case FORMAT_TLV:
+		out_char((char)record_type(header));
+		out_write((const char*)current_bssid, sizeof(current_bssid));
+		out_le(0, 4);
+		break;
+	}
+	record_start = out.len;
+}
+
+// Ends the record and writes it out
+static void record_end() {
+	switch (out_format) {
+	case FORMAT_TEXT:
+		out_char('\n');
+		break;
+	case FORMAT_JSON:
+		// every field ends with a comma, see field_end()
+		if (out.len > record_start && out.data[out.len - 1] == ',')
+			out.len--;
+		out_str("]}\n");
+		break;
+	case FORMAT_TLV:
+		out_patch_le(record_start - 4, out.len - record_start, 4);
+		break;
+	}
+	out_flush();
+}
+
+// Starts a data line: AP_DATA,<mac>,<section>,<key>: followed by the value
+static void field_begin(const char* section_name, const char* key) {
+	if (section_name == NULL)
+		section_name = BSS_SECTION;
+
+	switch (out_format) {
+	case FORMAT_TEXT:
+		out_str(DATA_STR);
+		out_str(current_mac);
+		out_char(',');
+		out_str(section_name);
+		if (current_source != NULL) {
+			out_char('-');
+			out_str(current_source);
+		}
+		out_char(',');
+		out_str(key);
+		out_char(':');
+		break;
+	case FORMAT_JSON:
+		out_str("[\"");
+		out_str(section_name);
+		if (current_source != NULL) {
+			out_char('-');
+			out_str(current_source);
 		}
+		out_str("\",\"");
+		out_str(key);
+		out_str("\",\"");
+		break;
+	case FORMAT_TLV: {
+		size_t len = strlen(section_name);
+		if (current_source != NULL)
+			len += 1 + strlen(current_source);
+		out_char((char)len);
+		out_str(section_name);
+		if (current_source != NULL) {
+			out_char('-');
+			out_str(current_source);
+		}
+		out_char((char)strlen(key));
+		out_str(key);
+		out_le(0, 2);
+		break;
+	}
 	}
+	field_start = out.len;
+}
+
+static void field_end() {
+	switch (out_format) {
+	case FORMAT_TEXT:
+		out_char('\n');
+		break;
+	case FORMAT_JSON:
+		out_json_escape(field_start);
+		out_str("\"],");
+		break;
+	case FORMAT_TLV:
+		if (out.len - field_start > 0xffff)
+			out.len = field_start + 0xffff;
+		out_patch_le(field_start - 2, out.len - field_start, 2);
+		break;
+	}
+}
+
+static void sep_if_not_first(bool *first, const char* separator = ",")
+{
+	if (!*first)
+		out_str(separator);
+	else
+		*first = false;
+}
+
+// Selects the BSS the following records and data lines are about
+static void set_current_bssid(const unsigned char* mac) {
+	memcpy(current_bssid, mac, sizeof(current_bssid));
+	mac_addr_n2a(current_mac, mac);
 }
 
+// Data lines selected with --fields. The keys of the RSN and WPA sections are the
+// RSN_* flags plus RSN_FIELD_VERSION, shifted into place.
+enum {
+	FIELD_INTERFACE		= 1 << 0,
+	FIELD_SIGNAL		= 1 << 1,
+	FIELD_FREQUENCY		= 1 << 2,
+	FIELD_CAPABILITIES	= 1 << 3,
+	FIELD_SSID		= 1 << 4,
+	FIELD_WPS		= 1 << 5,
+	FIELD_LAST_SEEN		= 1 << 6,
+	FIELD_BSS		= FIELD_INTERFACE | FIELD_SIGNAL | FIELD_FREQUENCY | FIELD_CAPABILITIES | FIELD_SSID |
+				  FIELD_LAST_SEEN,
+};
+
+const unsigned int RSN_FIELD_VERSION = 1 << 6;
+const unsigned int RSN_FIELDS = RSN_GROUP_CIPHER | RSN_PAIRWISE | RSN_AKM | RSN_CAPABILITIES | RSN_PMKID_COUNT |
+	RSN_GROUP_MGMT_CIPHER | RSN_FIELD_VERSION;
+const int FIELD_RSN_SHIFT = 8;
+const int FIELD_WPA_SHIFT = 16;
+const unsigned int FIELDS_ALL = FIELD_BSS | FIELD_WPS | RSN_FIELDS << FIELD_RSN_SHIFT | RSN_FIELDS << FIELD_WPA_SHIFT;
+
+// the data lines that are printed
+static unsigned int out_fields = FIELDS_ALL;
+
 static void print_capa_dmg(__u16 capa, bool* first)
 {
 	switch (capa & WLAN_CAPABILITY_DMG_TYPE_MASK) {
 		case WLAN_CAPABILITY_DMG_TYPE_AP: {
 			sep_if_not_first(first);
-			printf("DMG_ESS");
+			out_str("DMG_ESS");
 			break;
 		}
 		case WLAN_CAPABILITY_DMG_TYPE_PBSS: {
 			sep_if_not_first(first);
-			printf("DMG_PCP");
+			out_str("DMG_PCP");
 			break;
 		}
 		case WLAN_CAPABILITY_DMG_TYPE_IBSS: {
 			sep_if_not_first(first);
-			printf("DMG_IBSS");
+			out_str("DMG_IBSS");
 			break;
 		}
 	}
 
 	if (capa & WLAN_CAPABILITY_DMG_CBAP_ONLY){
 		sep_if_not_first(first);
-		printf("CBAP_Only");
+		out_str("CBAP_Only");
 	}
 	if (capa & WLAN_CAPABILITY_DMG_CBAP_SOURCE){
 		sep_if_not_first(first);
-		printf("CBAP_Src");
+		out_str("CBAP_Src");
 	}
 	if (capa & WLAN_CAPABILITY_DMG_PRIVACY){
 		sep_if_not_first(first);
-		printf("Privacy");
+		out_str("Privacy");
 	}
 	if (capa & WLAN_CAPABILITY_DMG_ECPAC){
 		sep_if_not_first(first);
-		printf("ECPAC");
+		out_str("ECPAC");
 	}
 	if (capa & WLAN_CAPABILITY_DMG_SPECTRUM_MGMT){
 		sep_if_not_first(first);
-		printf("SpectrumMgmt");
+		out_str("SpectrumMgmt");
 	}
 	if (capa & WLAN_CAPABILITY_DMG_RADIO_MEASURE){
 		sep_if_not_first(first);
-		printf("RadioMeasure");
+		out_str("RadioMeasure");
 	}
 }
 
@@ -205,67 +493,219 @@ static void print_capa_non_dmg(__u16 capa, bool* first)
 {
 	if (capa & WLAN_CAPABILITY_ESS){
 		sep_if_not_first(first);
-		printf("ESS");
+		out_str("ESS");
 	}
 	if (capa & WLAN_CAPABILITY_IBSS){
 		sep_if_not_first(first);
-		printf("IBSS");
+		out_str("IBSS");
 	}
 	if (capa & WLAN_CAPABILITY_CF_POLLABLE){
 		sep_if_not_first(first);
-		printf("CfPollable");
+		out_str("CfPollable");
 	}
 	if (capa & WLAN_CAPABILITY_CF_POLL_REQUEST){
 		sep_if_not_first(first);
-		printf("CfPollReq");
+		out_str("CfPollReq");
 	}
 	if (capa & WLAN_CAPABILITY_PRIVACY){
 		sep_if_not_first(first);
-		printf("Privacy");
+		out_str("Privacy");
 	}
 	if (capa & WLAN_CAPABILITY_SHORT_PREAMBLE){
 		sep_if_not_first(first);
-		printf("ShortPreamble");
+		out_str("ShortPreamble");
 	}
 	if (capa & WLAN_CAPABILITY_PBCC){
 		sep_if_not_first(first);
-		printf("PBCC");
+		out_str("PBCC");
 	}
 	if (capa & WLAN_CAPABILITY_CHANNEL_AGILITY){
 		sep_if_not_first(first);
-		printf("ChannelAgility");
+		out_str("ChannelAgility");
 	}
 	if (capa & WLAN_CAPABILITY_SPECTRUM_MGMT){
 		sep_if_not_first(first);
-		printf("SpectrumMgmt");
+		out_str("SpectrumMgmt");
 	}
 	if (capa & WLAN_CAPABILITY_QOS){
 		sep_if_not_first(first);
-		printf("QoS");
+		out_str("QoS");
 	}
 	if (capa & WLAN_CAPABILITY_SHORT_SLOT_TIME){
 		sep_if_not_first(first);
-		printf("ShortSlotTime");
+		out_str("ShortSlotTime");
 	}
 	if (capa & WLAN_CAPABILITY_APSD){
 		sep_if_not_first(first);
-		printf("APSD");
+		out_str("APSD");
 	}
 	if (capa & WLAN_CAPABILITY_RADIO_MEASURE){
 		sep_if_not_first(first);
-		printf("RadioMeasure");
+		out_str("RadioMeasure");
 	}
 	if (capa & WLAN_CAPABILITY_DSSS_OFDM){
 		sep_if_not_first(first);
-		printf("DSSS-OFDM");
+		out_str("DSSS-OFDM");
 	}
 	if (capa & WLAN_CAPABILITY_DEL_BACK){
 		sep_if_not_first(first);
-		printf("DelayedBACK");
+		out_str("DelayedBACK");
 	}
 	if (capa & WLAN_CAPABILITY_IMM_BACK){
 		sep_if_not_first(first);
-		printf("ImmediateBACK");
+		out_str("ImmediateBACK");
+	}
+}
+
+static void print_ssid(const struct ssid_info* ssid) {
+
+	int i;
+	int len = ssid->len;
+	const __u8* data = ssid->data;
+
+	field_begin(NULL, "ssid");
+	for (i = 0; i < len; i++) {
+		if (isprint(data[i]) && data[i] != ' ' && data[i] != '\\') {
+			out_char(data[i]);
+		} else if (data[i] == ' ' && (i != 0 && i != len -1)) {
+			out_char(' ');
+		} else {
+			out_str("\\x");
+			out_hex(data[i], 2);
+		}
+	}
+	field_end();
+}
+
+// Unknown cipher and AKM suites are printed as <OUI>:<type>, e.g. 00-0f-ac:20
+static void print_suite_id(__u32 suite) {
+	out_hex((suite >> 24) & 0xff, 2);
+	out_char('-');
+	out_hex((suite >> 16) & 0xff, 2);
+	out_char('-');
+	out_hex((suite >> 8) & 0xff, 2);
+	out_char(':');
+	out_uint(suite & 0xff);
+}
+
+static void print_suites(const __u32* suites, int count, const char* (*name)(__u32)) {
+	for (int i = 0; i < count; i++) {
+		const char* s = name(suites[i]);
+
+		if (i > 0) out_char(',');
+		if (s != NULL)
+			out_str(s);
+		else
+			print_suite_id(suites[i]);
+	}
+}
+
+static void print_rsn_capabilities(__u16 capa) {
+
+	bool first = true;
+
+	if (capa & 0x0001)
+		{sep_if_not_first(&first); out_str("PreAuth");}
+	if (capa & 0x0002)
+		{sep_if_not_first(&first); out_str("NoPairwise");}
+	switch ((capa & 0x000c) >> 2) {
+	case 0:
+		{sep_if_not_first(&first); out_str("1-PTKSA-RC");
+		break;}
+	case 1:
+		{sep_if_not_first(&first); out_str("2-PTKSA-RC");
+		break;}
+	case 2:
+		{sep_if_not_first(&first); out_str("4-PTKSA-RC");
+		break;}
+	case 3:
+		{sep_if_not_first(&first); out_str("16-PTKSA-RC");
+		break;}
+	}
+	switch ((capa & 0x0030) >> 4) {
+	case 0:
+		{sep_if_not_first(&first); out_str("1-GTKSA-RC");
+		break;}
+	case 1:
+		{sep_if_not_first(&first); out_str("2-GTKSA-RC");
+		break;}
+	case 2:
+		{sep_if_not_first(&first); out_str("4-GTKSA-RC");
+		break;}
+	case 3:
+		{sep_if_not_first(&first); out_str("16-GTKSA-RC");
+		break;}
+	}
+	if (capa & 0x0040)
+		{sep_if_not_first(&first); out_str("MFP-required");}
+	if (capa & 0x0080)
+		{sep_if_not_first(&first); out_str("MFP-capable");}
+	if (capa & 0x0200)
+		{sep_if_not_first(&first); out_str("Peerkey-enabled");}
+	if (capa & 0x0400)
+		{sep_if_not_first(&first); out_str("SPP-AMSDU-capable");}
+	if (capa & 0x0800)
+		{sep_if_not_first(&first); out_str("SPP-AMSDU-required");}
+	if (capa & 0x2000)
+		{sep_if_not_first(&first); out_str("Extended-Key-ID");}
+	{sep_if_not_first(&first); out_str("(0x"); out_hex(capa, 4); out_char(')');}
+}
+
+// Prints the keys (RSN_* and RSN_FIELD_VERSION) of a decoded RSN or WPA element
+static void print_rsn(const struct rsn_info* rsn, const char* section_name, unsigned int keys) {
+
+	if (keys & RSN_FIELD_VERSION) {
+		field_begin(section_name, "version");
+		out_uint(rsn->version);
+		field_end();
+	}
+
+	unsigned int fields = rsn->fields & keys;
+
+	if (fields & RSN_GROUP_CIPHER) {
+		field_begin(section_name, "group cipher");
+		print_suites(&rsn->group_cipher, 1, cipher_suite_name);
+		field_end();
+	}
+
+	if (fields & RSN_PAIRWISE) {
+		field_begin(section_name, "pairwise ciphers");
+		print_suites(rsn->pairwise, rsn->npairwise, cipher_suite_name);
+		field_end();
+	}
+
+	if (fields & RSN_AKM) {
+		field_begin(section_name, "authentication suites");
+		print_suites(rsn->akm, rsn->nakm, akm_suite_name);
+		field_end();
+	}
+
+	if (fields & RSN_CAPABILITIES) {
+		field_begin(section_name, "capabilities");
+		print_rsn_capabilities(rsn->capabilities);
+		field_end();
+	}
+
+	if (fields & RSN_PMKID_COUNT) {
+		field_begin(section_name, "PMKID count");
+		out_int(rsn->pmkid_count);
+		field_end();
+	}
+
+	if (fields & RSN_GROUP_MGMT_CIPHER) {
+		field_begin(section_name, "group mgmt cipher suite");
+		print_suites(&rsn->group_mgmt_cipher, 1, cipher_suite_name);
+		field_end();
+	}
+
+	if (rsn->tail_len != 0) {
+		field_begin(section_name, "bogus tail data");
+		out_uint(rsn->tail_len);
+		for (int i = 0; i < rsn->tail_len; i++) {
+			out_char(' ');
+			out_hex(rsn->tail[i], 2);
+		}
+		field_end();
 	}
 }
 
@@ -289,1023 +729,1485 @@ static const char * wifi_wps_dev_passwd_id(uint16_t id)
 	}
 }
 
-static void print_wifi_wps(const uint8_t type, uint8_t len, const uint8_t *data,
-			   struct print_ies_data *ie_buffer, const char* section_name)
-{
-	__u16 subtype, sublen;
-
-	while (len >= 4) {
-		subtype = (data[0] << 8) + data[1];
-		sublen = (data[2] << 8) + data[3];
-		if (sublen > len - 4)
-			break;
-
-		switch (subtype) {
-		case 0x104a:
-			if (sublen < 1) break;
-
-			dataline(section_name);
-			printf("version:%d.%d\n", data[4] >> 4, data[4] & 0xF);
-			break;
-		case 0x1011:
-			dataline(section_name);
-			printf("device name:%.*s\n", sublen, data + 4);
-			break;
-		case 0x1012: {
-			uint16_t id;
-			if (sublen != 2) break;
-			
-			id = data[4] << 8 | data[5];
-			dataline(section_name);
-			printf("device password id:%u (%s)\n", id, wifi_wps_dev_passwd_id(id));
-			break;
-		}
-		case 0x1021:
-			dataline(section_name);
-			printf("manufacturer:%.*s\n", sublen, data + 4);
-			break;
-		case 0x1023:
-			dataline(section_name);
-			printf("model:%.*s\n", sublen, data + 4);
-			break;
-		case 0x1024:
-			dataline(section_name);
-			printf("model Number:%.*s\n", sublen, data + 4);
-			break;
-		case 0x103b: {
-			__u8 val;
-
-			if (sublen < 1) break;
-			
-			val = data[4];
-			dataline(section_name);
-			printf("response type:%d%s\n", val, val == 3 ? " (AP)" : "");
-			break;
-		}
-		case 0x103c: {
-			__u8 val;
-
-			if (sublen < 1) break;
-
-			val = data[4];
-			dataline(section_name);
-			printf("rf bands:0x%x\n", val);
-			break;
-		}
-		case 0x1041: {
-			__u8 val;
-
-			if (sublen < 1) break;
-
-			val = data[4];
-			dataline(section_name);
-			printf("selected registrar:0x%x\n", val);
-			break;
-		}
-		case 0x1042:
-			dataline(section_name);
-			printf("serial number:%.*s\n", sublen, data + 4);
-			break;
-		case 0x1044: {
-			__u8 val;
-
-			if (sublen < 1) break;
-
-			val = data[4];
-			dataline(section_name);
-			printf("wi-fi protected setup state:%d%s%s\n",
-			       val,
-			       val == 1 ? " (Unconfigured)" : "",
-			       val == 2 ? " (Configured)" : "");
-			break;
-		}
-		case 0x1047:
-			if (sublen != 16) break;
-
-			dataline(section_name);
-			printf("uuid:%02x%02x%02x%02x-%02x%02x-%02x%02x-"
-				"%02x%02x-%02x%02x%02x%02x%02x%02x\n",
-				data[4], data[5], data[6], data[7],
-				data[8], data[9], data[10], data[11],
-				data[12], data[13], data[14], data[15],
-				data[16], data[17], data[18], data[19]);
-			break;
-		case 0x1049:
-			if (sublen == 6 &&
-			    data[4] == 0x00 &&
-			    data[5] == 0x37 &&
-			    data[6] == 0x2a &&
-			    data[7] == 0x00 &&
-			    data[8] == 0x01) {
-				uint8_t v2 = data[9];
-				dataline(section_name);
-				printf("version2:%d.%d\n", v2 >> 4, v2 & 0xf);
-			}
-			break;
-		case 0x1054: {
-			if (sublen != 8) break;
-
-			dataline(section_name);
-			printf("primary device type:"
-			       "%u-%02x%02x%02x%02x-%u\n",
-			       data[4] << 8 | data[5],
-			       data[6], data[7], data[8], data[9],
-			       data[10] << 8 | data[11]);
-			break;
-		}
-		case 0x1057: {
-			__u8 val;
+static void print_wps_config_methods(__u16 meth) {
 
-			if (sublen < 1) break;
+	bool comma = false;
 
-			val = data[4];
-			dataline(section_name);
-			printf("ap setup locked:0x%.2x\n", val);
-			break;
-		}
-		case 0x1008:
-		case 0x1053: {
-			__u16 meth;
-			bool comma;
-
-			if (sublen < 2) break;
-
-			meth = (data[4] << 8) + data[5];
-			comma = false;
-			dataline(section_name);
-			printf("%sconfig methods:",
-			       subtype == 0x1053 ? "selected registrar ": "");
 #define T(bit, name) do {		\
 	if (meth & (1<<bit)) {		\
 		if (comma)		\
-			printf(",");	\
+			out_str(",");	\
 		comma = true;		\
-		printf("%s",name);	\
+		out_str(name);	\
 	} } while (0)
-			T(0, "USB");
-			T(1, "Ethernet");
-			T(2, "Label");
-			T(3, "Display");
-			T(4, "Ext. NFC");
-			T(5, "Int. NFC");
-			T(6, "NFC Intf.");
-			T(7, "PBC");
-			T(8, "Keypad");
-			printf("\n");
-			break;
+	T(0, "USB");
+	T(1, "Ethernet");
+	T(2, "Label");
+	T(3, "Display");
+	T(4, "Ext. NFC");
+	T(5, "Int. NFC");
+	T(6, "NFC Intf.");
+	T(7, "PBC");
+	T(8, "Keypad");
 #undef T
-		}
-		default: {
-			break;
-		}
-		}
-
-		data += sublen + 4;
-		len -= sublen + 4;
-	}
 }
 
-void print_ssid(const uint8_t type, uint8_t len, const uint8_t *data,
-	struct print_ies_data *ie_buffer, const char* section_name) {
-
-	int i;
+static void print_wps_string(const char* section_name, const char* key, const char* value) {
+	field_begin(section_name, key);
+	out_str(value);
+	field_end();
+}
 
-	dataline();
-	printf("ssid:");
-	for (i = 0; i < len; i++) {
-		if (isprint(data[i]) && data[i] != ' ' && data[i] != '\\') {
-			printf("%c", data[i]);
-		} else if (data[i] == ' ' && (i != 0 && i != len -1)) {
-			printf(" ");
-		} else {
-			printf("\\x%.2x", data[i]);
+// Prints a decoded WPS element, in the order the attributes usually come in
+static void print_wps(const struct wps_info* wps, const char* section_name) {
+
+	if (wps->fields & WPS_VERSION) {
+		field_begin(section_name, "version");
+		out_uint(wps->version >> 4);
+		out_char('.');
+		out_uint(wps->version & 0xF);
+		field_end();
+	}
+	if (wps->fields & WPS_STATE) {
+		field_begin(section_name, "wi-fi protected setup state");
+		out_uint(wps->state);
+		if (wps->state == 1)
+			out_str(" (Unconfigured)");
+		else if (wps->state == 2)
+			out_str(" (Configured)");
+		field_end();
+	}
+	if (wps->fields & WPS_AP_SETUP_LOCKED) {
+		field_begin(section_name, "ap setup locked");
+		out_str("0x");
+		out_hex(wps->ap_setup_locked, 2);
+		field_end();
+	}
+	if (wps->fields & WPS_SELECTED_REGISTRAR) {
+		field_begin(section_name, "selected registrar");
+		out_str("0x");
+		out_hex(wps->selected_registrar, 1);
+		field_end();
+	}
+	if (wps->fields & WPS_PASSWORD_ID) {
+		field_begin(section_name, "device password id");
+		out_uint(wps->password_id);
+		out_str(" (");
+		out_str(wifi_wps_dev_passwd_id(wps->password_id));
+		out_char(')');
+		field_end();
+	}
+	if (wps->fields & WPS_SR_CONFIG_METHODS) {
+		field_begin(section_name, "selected registrar config methods");
+		print_wps_config_methods(wps->sr_config_methods);
+		field_end();
+	}
+	if (wps->fields & WPS_RESPONSE_TYPE) {
+		field_begin(section_name, "response type");
+		out_uint(wps->response_type);
+		if (wps->response_type == 3)
+			out_str(" (AP)");
+		field_end();
+	}
+	if (wps->fields & WPS_UUID) {
+		field_begin(section_name, "uuid");
+		for (int i = 0; i < 16; i++) {
+			if (i == 4 || i == 6 || i == 8 || i == 10)
+				out_char('-');
+			out_hex(wps->uuid[i], 2);
 		}
+		field_end();
+	}
+	if (wps->fields & WPS_MANUFACTURER)
+		print_wps_string(section_name, "manufacturer", wps->manufacturer);
+	if (wps->fields & WPS_MODEL)
+		print_wps_string(section_name, "model", wps->model);
+	if (wps->fields & WPS_MODEL_NUMBER)
+		print_wps_string(section_name, "model Number", wps->model_number);
+	if (wps->fields & WPS_SERIAL_NUMBER)
+		print_wps_string(section_name, "serial number", wps->serial_number);
+	if (wps->fields & WPS_DEVICE_TYPE) {
+		field_begin(section_name, "primary device type");
+		out_uint(wps->device_category);
+		out_char('-');
+		for (int i = 0; i < 4; i++)
+			out_hex(wps->device_oui[i], 2);
+		out_char('-');
+		out_uint(wps->device_subcategory);
+		field_end();
+	}
+	if (wps->fields & WPS_DEVICE_NAME)
+		print_wps_string(section_name, "device name", wps->device_name);
+	if (wps->fields & WPS_CONFIG_METHODS) {
+		field_begin(section_name, "config methods");
+		print_wps_config_methods(wps->config_methods);
+		field_end();
+	}
+	if (wps->fields & WPS_RF_BANDS) {
+		field_begin(section_name, "rf bands");
+		out_str("0x");
+		out_hex(wps->rf_bands, 1);
+		field_end();
+	}
+	if (wps->fields & WPS_VERSION2) {
+		field_begin(section_name, "version2");
+		out_uint(wps->version2 >> 4);
+		out_char('.');
+		out_uint(wps->version2 & 0xf);
+		field_end();
 	}
-	printf("\n");
 }
 
-void print_auth(const uint8_t *data) {
+// An element whose length is outside of what its decoder accepts
+static void print_invalid_ie(const struct ie_state* ie, const char* section_name) {
+	field_begin(section_name, "invalid");
+	if (ie->len > 1) {
+		out_uint(ie->len);
+		out_str(" bytes");
+	} else if (ie->len) {
+		out_str("1 byte ");
+		out_hex(ie->first, 2);
+	}  else {
+		out_str("no data");
+	}
+	field_end();
+}
 
-	// This is copied from iw sources, and I have no idea how this works
-	// There's a lot of magic numbers going around.
+// The kinds of elements that are printed, in the order they are printed
+enum {
+	IE_KIND_SSID,
+	IE_KIND_RSN,
+	IE_KIND_WPA,
+	IE_KIND_WPS,
+	IE_KINDS,
+};
 
-	if (memcmp(data, ms_oui, 3) == 0) {
-		switch (data[3]) {
-		case 1:
-			printf("IEEE 802.1X");
-			break;
-		case 2:
-			printf("PSK");
-			break;
-		default:
-			printf("%.02x-%.02x-%.02x:%d", data[0], data[1] ,data[2], data[3]);
-			break;
-		}
-	} else if (memcmp(data, ieee80211_oui, 3) == 0) {
-		switch (data[3]) {
-		case 1:
-			printf("IEEE 802.1X");
-			break;
-		case 2:
-			printf("PSK");
-			break;
-		case 3:
-			printf("FT/IEEE 802.1X");
-			break;
-		case 4:
-			printf("FT/PSK");
-			break;
-		case 5:
-			printf("IEEE 802.1X/SHA-256");
-			break;
-		case 6:
-			printf("PSK/SHA-256");
-			break;
-		case 7:
-			printf("TDLS/TPK");
-			break;
-		case 8:
-			printf("SAE");
-			break;
-		case 9:
-			printf("FT/SAE");
-			break;
-		case 11:
-			printf("IEEE 802.1X/SUITE-B");
-			break;
-		case 12:
-			printf("IEEE 802.1X/SUITE-B-192");
-			break;
-		case 13:
-			printf("FT/IEEE 802.1X/SHA-384");
-			break;
-		case 14:
-			printf("FILS/SHA-256");
-			break;
-		case 15:
-			printf("FILS/SHA-384");
-			break;
-		case 16:
-			printf("FT/FILS/SHA-256");
-			break;
-		case 17:
-			printf("FT/FILS/SHA-384");
-			break;
-		case 18:
-			printf("OWE");
-			break;
-		default:
-			printf("%.02x-%.02x-%.02x:%d", data[0], data[1] ,data[2], data[3]);
-			break;
-		}
-	} else if (memcmp(data, wfa_oui, 3) == 0) {
-		switch (data[3]) {
-		case 1:
-			printf("OSEN");
-			break;
-		case 2:
-			printf("DPP");
-			break;
-		default:
-			printf("%.02x-%.02x-%.02x:%d", data[0], data[1] ,data[2], data[3]);
-			break;
-		}
-	} else {
-		printf("%.02x-%.02x-%.02x:%d", data[0], data[1] ,data[2], data[3]);
+static const struct ie_state* ie_kind_state(const struct bss_ies* ies, int kind) {
+	switch (kind) {
+	case IE_KIND_SSID:
+		return &ies->ssid.ie;
+	case IE_KIND_RSN:
+		return &ies->rsn.ie;
+	case IE_KIND_WPA:
+		return &ies->wpa.ie;
+	default:
+		return &ies->wps.ie;
 	}
 }
 
-// Copied from iw sources, no idea what the magic values are
-static void print_cipher(const uint8_t *data) {
-
-	if (memcmp(data, ms_oui, 3) == 0) {
-		switch (data[3]) {
-		case 0:
-			printf("Use group cipher suite");
-			break;
-		case 1:
-			printf("WEP-40");
-			break;
-		case 2:
-			printf("TKIP");
-			break;
-		case 4:
-			printf("CCMP");
-			break;
-		case 5:
-			printf("WEP-104");
-			break;
-		default:
-			printf("%.02x-%.02x-%.02x:%d", data[0], data[1] ,data[2], data[3]);
-			break;
-		}
-	} else if (memcmp(data, ieee80211_oui, 3) == 0) {
-		switch (data[3]) {
-		case 0:
-			printf("Use group cipher suite");
-			break;
-		case 1:
-			printf("WEP-40");
-			break;
-		case 2:
-			printf("TKIP");
-			break;
-		case 4:
-			printf("CCMP");
-			break;
-		case 5:
-			printf("WEP-104");
-			break;
-		case 6:
-			printf("AES-128-CMAC");
-			break;
-		case 7:
-			printf("NO-GROUP");
-			break;
-		case 8:
-			printf("GCMP");
-			break;
-		default:
-			printf("%.02x-%.02x-%.02x:%d", data[0], data[1] ,data[2], data[3]);
-			break;
-		}
-	} else {
-		printf("%.02x-%.02x-%.02x:%d", data[0], data[1] ,data[2], data[3]);
+// Whether an element decoded the same from both frames
+static bool ie_kind_equal(const struct bss_ies* a, const struct bss_ies* b, int kind) {
+	switch (kind) {
+	case IE_KIND_SSID:
+		return memcmp(&a->ssid, &b->ssid, sizeof(a->ssid)) == 0;
+	case IE_KIND_RSN:
+		return memcmp(&a->rsn, &b->rsn, sizeof(a->rsn)) == 0;
+	case IE_KIND_WPA:
+		return memcmp(&a->wpa, &b->wpa, sizeof(a->wpa)) == 0;
+	default:
+		return memcmp(&a->wps, &b->wps, sizeof(a->wps)) == 0;
 	}
 }
 
-// from iw source code, no idea what's going on here
-void print_rsn_ie(const char *defcipher, const char *defauth,
-	uint8_t len, const uint8_t *data, const char* section_name) {
-
-	__u16 count, capa;
-	int i;
-	int is_osen = 0;
-	bool first = true;
-
-	dataline(section_name);
-	if (!is_osen) {
-		__u16 version;
-		version = data[0] + (data[1] << 8);
-		printf("version:%d\n", version);
-		data += 2;
-		len -= 2;
+// The keys of --fields that select lines of a kind of element, 0 if none does
+static unsigned int ie_kind_fields(int kind) {
+	switch (kind) {
+	case IE_KIND_SSID:
+		return out_fields & FIELD_SSID;
+	case IE_KIND_RSN:
+		return (out_fields >> FIELD_RSN_SHIFT) & RSN_FIELDS;
+	case IE_KIND_WPA:
+		return (out_fields >> FIELD_WPA_SHIFT) & RSN_FIELDS;
+	default:
+		return out_fields & FIELD_WPS;
 	}
+}
+
+// Prints one decoded element, tagged with current_source
+static void print_ie_kind(const struct bss_ies* ies, int kind) {
+	static const char* names[IE_KINDS] = { "SSID", "RSN", "WPA", "WPS" };
+	const struct ie_state* ie = ie_kind_state(ies, kind);
+	unsigned int keys = ie_kind_fields(kind);
 
-	if (len < 4) {
-		dataline(section_name);
-		printf("group cipher:%s\n", defcipher);
-		dataline(section_name);
-		printf("pairwise ciphers:%s\n", defcipher);
+	if (ie->status == IE_ABSENT || keys == 0) {
+		return;
+	} else if (ie->status == IE_INVALID) {
+		print_invalid_ie(ie, names[kind]);
 		return;
 	}
 
-	dataline(section_name);
-	printf("group cipher:");
-	print_cipher(data);
-	printf("\n");
+	switch (kind) {
+	case IE_KIND_SSID:
+		print_ssid(&ies->ssid);
+		break;
+	case IE_KIND_RSN:
+		print_rsn(&ies->rsn, names[kind], keys);
+		break;
+	case IE_KIND_WPA:
+		print_rsn(&ies->wpa, names[kind], keys);
+		break;
+	case IE_KIND_WPS:
+		print_wps(&ies->wps, names[kind]);
+		break;
+	}
+}
 
-	data += 4;
-	len -= 4;
+// Prints the information elements of a BSS
+static void print_bss_ies(const struct bss_record* bss) {
 
-	if (len < 2) {
-		dataline(section_name);
-		printf("pairwise ciphers:%s\n", defcipher);
-		return;
+	// The kernel reports the elements of the last frame received from the BSS and,
+	// separately, those of its last beacon. Elements that are the same in both are
+	// printed once, the ones found in only one of them get the source in the section
+	// name.
+	for (int kind = 0; kind < IE_KINDS; kind++) {
+		current_source = NULL;
+		if (bss->beacon_differs && !ie_kind_equal(&bss->elements, &bss->beacon, kind))
+			current_source = "presp";
+		print_ie_kind(&bss->elements, kind);
 	}
 
-	count = data[0] | (data[1] << 8);
-	if (2 + (count * 4) > len) {
-		goto invalid;
+	current_source = "beacon";
+	for (int kind = 0; bss->beacon_differs && kind < IE_KINDS; kind++) {
+		if (!ie_kind_equal(&bss->elements, &bss->beacon, kind))
+			print_ie_kind(&bss->beacon, kind);
 	}
+	current_source = NULL;
+}
 
-	dataline(section_name);
-	printf("pairwise ciphers:");
-	for (i = 0; i < count; i++) {
-		if (i > 0) printf(",");
-		print_cipher(data + 2 + (i * 4));
-	}
-	printf("\n");
+// Prints the record of a BSS, registered as the bss_callback of the scan context
+static void print_bss(const struct bss_record* bss, void* arg) {
 
-	data += 2 + (count * 4);
-	len -= 2 + (count * 4);
+	const struct scan_ctx* ctx = (const scan_ctx*)arg;
+	int changes = bss->changes;
+	const char* header = DISCOVER_STR;
 
-	if (len < 2) {
-		dataline(section_name);
-		printf("authentication suites:%s\n", defauth);
-		return;
-	}
+	if (server)
+		server_update(server, bss);
+
+	if (changes & BSS_GONE)
+		header = GONE_STR;
+	else if (ctx->diff_hysteresis >= 0)
+		header = (changes & BSS_NEW) ? NEW_STR : CHANGED_STR;
+
+	set_current_bssid(bss->bssid);
 
-	count = data[0] | (data[1] << 8);
-	if (2 + (count * 4) > len) {
-		goto invalid;
+	record_begin(header);
+
+	if (ctx->ntargets > 1 && (out_fields & FIELD_INTERFACE)) {
+		field_begin(NULL, "interface");
+		out_str(bss->ifname);
+		field_end();
 	}
 
-	dataline(section_name);
-	printf("authentication suites:");
-	for (i = 0; i < count; i++) {
-		if (i > 0) printf(",");
-		print_auth(data + 2 + (i * 4));
+	// the interface alone is no change
+	size_t fields_start = out.len;
+
+	if (!(changes & BSS_SIGNAL) || !(out_fields & FIELD_SIGNAL)) {
+		// unchanged in --diff mode, or not selected
+	} else if (bss->has_signal_mbm) {
+		field_begin(NULL, "signal strength");
+		out_int(bss->signal_mbm);
+		out_str(" mBm");
+		field_end();
+	} else if (bss->has_signal_unspec) {
+		field_begin(NULL, "signal strength");
+		out_uint(bss->signal_unspec);
+		out_str(" units");
+		field_end();
 	}
-	printf("\n");
 
-	data += 2 + (count * 4);
-	len -= 2 + (count * 4);
-
-	if (len >= 2) {
-		capa = data[0] | (data[1] << 8);
-		dataline(section_name);
-		printf("capabilities:");
-		if (capa & 0x0001)
-			{sep_if_not_first(&first); printf("PreAuth");}
-		if (capa & 0x0002)
-			{sep_if_not_first(&first); printf("NoPairwise");}
-		switch ((capa & 0x000c) >> 2) {
-		case 0:
-			{sep_if_not_first(&first); printf("1-PTKSA-RC");
-			break;}
-		case 1:
-			{sep_if_not_first(&first); printf("2-PTKSA-RC");
-			break;}
-		case 2:
-			{sep_if_not_first(&first); printf("4-PTKSA-RC");
-			break;}
-		case 3:
-			{sep_if_not_first(&first); printf("16-PTKSA-RC");
-			break;}
-		}
-		switch ((capa & 0x0030) >> 4) {
-		case 0:
-			{sep_if_not_first(&first); printf("1-GTKSA-RC");
-			break;}
-		case 1:
-			{sep_if_not_first(&first); printf("2-GTKSA-RC");
-			break;}
-		case 2:
-			{sep_if_not_first(&first); printf("4-GTKSA-RC");
-			break;}
-		case 3:
-			{sep_if_not_first(&first); printf("16-GTKSA-RC");
-			break;}
-		}
-		if (capa & 0x0040)
-			{sep_if_not_first(&first); printf("MFP-required");}
-		if (capa & 0x0080)
-			{sep_if_not_first(&first); printf("MFP-capable");}
-		if (capa & 0x0200)
-			{sep_if_not_first(&first); printf("Peerkey-enabled");}
-		if (capa & 0x0400)
-			{sep_if_not_first(&first); printf("SPP-AMSDU-capable");}
-		if (capa & 0x0800)
-			{sep_if_not_first(&first); printf("SPP-AMSDU-required");}
-		if (capa & 0x2000)
-			{sep_if_not_first(&first); printf("Extended-Key-ID");}
-		{sep_if_not_first(&first); printf("(0x%.4x)", capa);}
-		data += 2;
-		len -= 2;
-		printf("\n");
-	}
-
-	if (len >= 2) {
-		int pmkid_count = data[0] | (data[1] << 8);
-
-		if (len >= 2 + 16 * pmkid_count) {
-			dataline(section_name);
-			printf("PMKID count:%d\n", pmkid_count);
-			/* not printing PMKID values */
-			data += 2 + 16 * pmkid_count;
-			len -= 2 + 16 * pmkid_count;
-		} else {
-			goto invalid;
+	if (bss->freq && (changes & BSS_FREQ) && (out_fields & FIELD_FREQUENCY)) {
+		field_begin(NULL, "frequency");
+		out_int(bss->freq);
+		if (bss->freq_offset > 0) {
+			out_char('.');
+			out_int(bss->freq_offset);
 		}
+		out_str(" MHz");
+		field_end();
 	}
 
-	if (len >= 4) {
-		dataline(section_name);
-		printf("group mgmt cipher suite:");
-		print_cipher(data);
-		data += 4;
-		len -= 4;
-		printf("\n");
+	if (bss->has_capability && (changes & BSS_CAPA) && (out_fields & FIELD_CAPABILITIES)) {
+		bool first = true;
+		field_begin(NULL, "capabilities");
+		if (bss->freq > 45000)
+			print_capa_dmg(bss->capability, &first);
+		else
+			print_capa_non_dmg(bss->capability, &first);
+
+		sep_if_not_first(&first);
+		out_str("(0x");
+		out_hex(bss->capability, 4);
+		out_char(')');
+		field_end();
 	}
 
-invalid:
-	if (len != 0) {
-		dataline(section_name);
-		printf("bogus tail data:%d", len);
-		while (len) {
-			printf(" %.2x", *data);
-			data++;
-			len--;
-		}
-		printf("\n");
+	if (changes & BSS_IES)
+		print_bss_ies(bss);
+
+	// only fields that --fields left out changed
+	if (header == CHANGED_STR && out.len == fields_start) {
+		out.len = record_header;
+		return;
 	}
 
-}
+	// with split channel scanning the BSSes of the channels that were not scanned
+	// come from earlier cycles. The age alone is no change.
+	if (ctx->split_channels > 0 && !(changes & BSS_GONE) && bss->has_seen_ms_ago &&
+		(out_fields & FIELD_LAST_SEEN)) {
+		field_begin(NULL, "last seen");
+		out_uint(bss->seen_ms_ago);
+		out_str(" ms ago");
+		field_end();
+	}
 
-// from iw source code
-void print_rsn(const uint8_t type, uint8_t len, const uint8_t *data,
-	struct print_ies_data *ie_buffer, const char* section_name) {
-	print_rsn_ie("CCMP", "IEEE 802.1X", len, data, section_name);
+	record_end();
 }
 
-static void print_wifi_wpa(const uint8_t type, uint8_t len, const uint8_t *data,
-	struct print_ies_data *ie_buffer, const char* section_name) {
-	print_rsn_ie("TKIP", "IEEE 802.1X", len, data, section_name);
+// Progress messages go to stdout like the records, errors to stderr
+static void print_log(int level, const char* message, void* arg) {
+	if (level == SCAN_LOG_ERROR)
+		fprintf(stderr, "%s\n", message);
+	else
+		printf("%s\n", message);
 }
 
-// this struct is used to create a handler for specific magic values of
-// IE (information element) in the wifi probe or beacon responses. From what
-// I gather, each IE requires a bit different type of parsing, and what I do
-// here is just directly copied from how iw does it. There's tons of magic
-// values in the code, and I couldn't figure out where they are defined.
-struct ie_print {
-	const char* name;
-	void (*print)(const uint8_t type, uint8_t len, const uint8_t *data,
-		struct print_ies_data *ie_buffer, const char* section_name);
-	uint8_t minlen;
-	uint8_t maxlen;
-};
+// Tells how often the receive path ran into trouble, if it ever did
+static void print_counters(const struct scan_ctx* ctx) {
+	const struct scan_counters* c = &ctx->counters;
 
-// This array size needs to be adjusted if magic values go beyond it. The array
-// contains empty elements for each type of IE that is not handled and is only 
-// modified at those points where we have an IE handler. See how it is done in
-// the beginning of main()
-const int MAX_IE_MAGIC = 112;
-static struct ie_print ieprinters[MAX_IE_MAGIC];
+	if (c->enobufs == 0 && c->truncated == 0 && c->buffer_grown == 0 && c->dump_intr == 0)
+		return;
 
-const int MAX_VENDOR_MAGIC = 112;
-static struct ie_print wifiprinters[MAX_VENDOR_MAGIC];
+	printf("netlink: %lu receive queue overflows, %lu truncated datagrams, %lu receive buffer resizes, "
+		"%lu interrupted dumps, %lu dump restarts\n",
+		c->enobufs, c->truncated, c->buffer_grown, c->dump_intr, c->dump_restarts);
+}
 
-// print a single IE parsed from a probe request or beacon response
-static void print_ie(const struct ie_print *p, const uint8_t type, uint8_t len, 
-	const uint8_t *data, struct print_ies_data *ie_buffer) {
+// Mean and quantiles of a histogram for print_stats, the quantiles as the bucket
+// bound they fall under
+static void print_histogram(const char* name, const struct scan_histogram* h) {
+	const double quantiles[] = { 0.5, 0.9, 0.99 };
 
-	// If no printer function is defined for type of IE
-	if (p->print == NULL) {
-		return;
-	}
+	printf("stats: %-9s %8lu times, mean %10.3f ms", name, h->count,
+		h->count ? (double)h->sum_ns / h->count / 1e6 : 0.0);
 
-	if (len < p->minlen || len > p->maxlen) {
-		if (len > 1) {
-			printf(",invalid %d bytes:", len);
-		} else if (len) {
-			printf(",invalid:1 byte %.02x>\n", data[0]);
-		}  else {
-			printf(",invalid:no data");
+	for (double q : quantiles) {
+		unsigned long cumulative = 0;
+		int i = 0;
+		if (h->count == 0)
+			break;
+		while (i < SCAN_HISTOGRAM_BUCKETS - 1 && cumulative + h->buckets[i] < q * h->count) {
+			cumulative += h->buckets[i];
+			i++;
 		}
-		return;
+		if (i < SCAN_HISTOGRAM_BUCKETS - 1)
+			printf(", p%g <= %g ms", q * 100, SCAN_HISTOGRAM_BOUNDS_US[i] / 1e3);
+		else
+			printf(", p%g > %g ms", q * 100, SCAN_HISTOGRAM_BOUNDS_US[i - 1] / 1e3);
 	}
+	printf("\n");
+}
+
+// Summary of --stats
+static void print_stats(const struct scan_stats* stats) {
+	printf("stats: %lu scans requested, %lu aborted, %lu rejected as busy, %lu dumps, %lu BSSes, "
+		"%llu bytes received\n", stats->triggers, stats->aborts, stats->busy, stats->dumps, stats->bss,
+		stats->bytes);
 
-	p->print(type, len, data, ie_buffer, p->name);
+	for (int phase = 0; phase < SCAN_PHASES; phase++)
+		print_histogram(scan_phase_name(phase), &stats->phases[phase]);
 }
 
-static void print_vendor(unsigned char len, unsigned char *data)
-{
-	if (len < 3) {
-		return;
-	}
+static void write_prometheus_counter(FILE* f, const char* name, const char* help, unsigned long long value) {
+	fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+}
 
-	if (len >= 4 && memcmp(data, ms_oui, 3) == 0) {
-		if (data[3] < ARRAY_SIZE(wifiprinters) &&
-		    wifiprinters[data[3]].name) {
-			print_ie(&wifiprinters[data[3]], data[3], len - 4, data + 4, NULL);
-			return;
+// Writes the statistics in the Prometheus text format, for the textfile collector
+// of node_exporter. The file is replaced as a whole so that it is never read half
+// written. Returns non-zero on error.
+static int write_prometheus(const struct scan_ctx* ctx, const char* path) {
+	const struct scan_stats* stats = ctx->stats;
+	const struct scan_counters* c = &ctx->counters;
+	char tmp_path[PATH_MAX];
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+		return -ENAMETOOLONG;
+
+	FILE* f = fopen(tmp_path, "w");
+	if (f == NULL)
+		return -errno;
+
+	fprintf(f, "# HELP apscanner_phase_seconds Duration of the phases of the scan cycles\n"
+		"# TYPE apscanner_phase_seconds histogram\n");
+	for (int phase = 0; phase < SCAN_PHASES; phase++) {
+		const struct scan_histogram* h = &stats->phases[phase];
+		const char* name = scan_phase_name(phase);
+		unsigned long cumulative = 0;
+
+		for (int i = 0; i < SCAN_HISTOGRAM_BUCKETS - 1; i++) {
+			cumulative += h->buckets[i];
+			fprintf(f, "apscanner_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %lu\n", name,
+				SCAN_HISTOGRAM_BOUNDS_US[i] / 1e6, cumulative);
 		}
-
-		return;
+		fprintf(f, "apscanner_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %lu\n", name, h->count);
+		fprintf(f, "apscanner_phase_seconds_sum{phase=\"%s\"} %.9f\n", name, h->sum_ns / 1e9);
+		fprintf(f, "apscanner_phase_seconds_count{phase=\"%s\"} %lu\n", name, h->count);
+	}
+
+	write_prometheus_counter(f, "apscanner_scans_total", "Scans requested", stats->triggers);
+	write_prometheus_counter(f, "apscanner_scan_aborts_total", "Scans that were aborted", stats->aborts);
+	write_prometheus_counter(f, "apscanner_scan_busy_total", "Scan requests rejected with EBUSY", stats->busy);
+	write_prometheus_counter(f, "apscanner_dumps_total", "Complete scan result dumps", stats->dumps);
+	write_prometheus_counter(f, "apscanner_bss_total", "BSSes received", stats->bss);
+	write_prometheus_counter(f, "apscanner_received_bytes_total", "Netlink bytes received", stats->bytes);
+	write_prometheus_counter(f, "apscanner_receive_overflows_total", "Netlink receive queue overflows",
+		c->enobufs);
+	write_prometheus_counter(f, "apscanner_truncated_total", "Truncated netlink datagrams", c->truncated);
+	write_prometheus_counter(f, "apscanner_dump_interrupts_total", "Interrupted scan result dumps",
+		c->dump_intr);
+	write_prometheus_counter(f, "apscanner_dump_restarts_total", "Restarted scan result dumps",
+		c->dump_restarts);
+
+	if (ferror(f)) {
+		fclose(f);
+		unlink(tmp_path);
+		return -EIO;
+	}
+	if (fclose(f) != 0 || rename(tmp_path, path) != 0) {
+		int err = -errno;
+		unlink(tmp_path);
+		return err;
 	}
+
+	return 0;
 }
 
-// Go through all information elements and print them if a printer for them is defined
-void print_ies(unsigned char *ie, int ielen) {
-	struct print_ies_data ie_buffer = {
-		.ie = ie,
-		.ielen = ielen };
+// the file of --prometheus, NULL without it
+static const char* prometheus_path = NULL;
 
-	if (ie == NULL || ielen < 0) {
-		return;
-	}
+// The dump_callback: passes the end of a dump on to the query server and rewrites
+// the statistics file
+static void dump_done(const char* ifname, void* arg) {
+	const struct scan_ctx* ctx = (const struct scan_ctx*)arg;
+	static int reported_err = 0;
 
-	while (ielen >= 2 && ielen - 2 >= ie[1]) {
-		if (ie[0] < ARRAY_SIZE(ieprinters) && ieprinters[ie[0]].name) {
-			print_ie(&ieprinters[ie[0]], ie[0], ie[1], ie + 2, &ie_buffer);
-		} else if (ie[0] == 221) {
-			print_vendor(ie[1], ie + 2);
-		}
+	if (server)
+		server_dump_done(ifname, server);
 
-		ielen -= ie[1] + 2;
-		ie += ie[1] + 2;
+	if (prometheus_path) {
+		int err = write_prometheus(ctx, prometheus_path);
+		// a lasting problem is reported once, not after every dump
+		if (err != 0 && err != reported_err)
+			fprintf(stderr, "error writing %s: %d, %s\n", prometheus_path, -err, strerror(-err));
+		reported_err = err;
 	}
 }
 
-// Called by the kernel when the scan is done or has been aborted
-int scan_finished_cb(struct nl_msg* msg, void* arg) {
+// Command line options
+struct scan_options {
+	const char* ifnames[MAX_SCAN_TARGETS];
+	int nifnames;
+	bool all_interfaces;	// scan one interface of every wiphy
+	bool passive;		// only listen for scans of other processes
+	bool sched;		// let the firmware scan, params.sched_interval_ms apart
+	struct scan_params params;
+	struct scan_filter filter;
+	unsigned int fields;	// FIELD_*, 0 prints all
+	bool diff;		// only print changes between dumps
+	int diff_hysteresis;
+	long interval_ms;	// > 0 enables daemon mode, a scan is started every interval_ms
+	long interval_min_ms;	// bounds of the interval as it adapts to the churn,
+	long interval_max_ms;	// 0 = interval_ms
+	long count;		// number of scan cycles in daemon mode, 0 means forever
+	struct scan_timeouts timeouts;
+	struct scan_retry retry;
+	long max_age_ms;	// print the kernel's cached results while they are this fresh
+	int split_channels;	// channels per cycle in interval mode, 0 = all
+	int format;		// output_format
+	const char* record_path;	// write the netlink messages of the scans here
+	const char* replay_path;	// replay a recording instead of scanning
+	bool replay_realtime;	// at the recorded pace
+	struct scan_buffers buffers;
+	const char* shm_path;	// publish the BSS table in this file
+	const char* serve_path;	// answer queries on a Unix socket here
+	bool stats;		// print where the time went at exit
+	const char* prometheus_path;	// keep the statistics in this file
+};
 
-	struct genlmsghdr* gnlh = (genlmsghdr*)nlmsg_data(nlmsg_hdr(msg));
-	struct init_scan_results* results = (init_scan_results*)arg;
+// the scan context the signal handler stops
+static struct scan_ctx* stop_ctx = NULL;
 
-	if (gnlh->cmd == NL80211_CMD_SCAN_ABORTED) {
-		results->done = 1;
-		results->aborted = 1;
-	} else if (gnlh->cmd == NL80211_CMD_NEW_SCAN_RESULTS) {
-		results->done = 1;
-		results->aborted = 0;
-	}
-	// else probably an uninteresting multicast message.
+static void stop_handler(int signum) {
+	stop_ctx->stop = 1;
+}
 
-	return NL_SKIP;
+// SIGINT and SIGTERM end the long running modes cleanly
+static void install_stop_handler(struct scan_ctx* ctx) {
+	struct sigaction sa;
+	stop_ctx = ctx;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_handler;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 }
 
-// Called by the kernel with a dump of the successful scan's data. Called for each SSID.
-int receive_scan_result(struct nl_msg *msg, void *arg) {
+// Sleeps until the absolute monotonic time in *deadline. Returns early if a stop
+// was requested by a signal. The poll_fd of the context is served in the meantime.
+static void sleep_until(const struct scan_ctx* ctx, const struct timespec* deadline) {
+	if (ctx->poll_cb == NULL) {
+		while (!ctx->stop &&
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
+		}
+		return;
+	}
+
+	while (!ctx->stop) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long left_ns = (long long)(deadline->tv_sec - now.tv_sec) * 1000000000 +
+			(deadline->tv_nsec - now.tv_nsec);
+		if (left_ns <= 0)
+			break;
 
-	struct genlmsghdr* gnlh = (genlmsghdr*)nlmsg_data(nlmsg_hdr(msg));
+		struct pollfd pfd = { ctx->poll_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, (int)((left_ns + 999999) / 1000000)) > 0)
+			ctx->poll_cb(ctx->poll_cb_arg);
+	}
+}
 
-	// Container for netlink attribute indices, each pointing to different parts of the
-	// netlink message stream. These can be used to then parse further attributes from
-	// the stream. Go read netlink documentation and see if you have more luck
-	// understanding how the messaging works.
-	struct nlattr* tb[NL80211_ATTR_MAX + 1];
+// Adaptive interval: the share of the BSSes that were added, removed or moved in
+// a cycle decides the interval until the next one
+const int CHURN_SIGNAL_MBM = 600;	// a signal change that counts as a move
+const int CHURN_QUIET_PCT = 2;		// below, the interval grows by a quarter
+const int CHURN_BUSY_PCT = 10;		// from here on it is halved
+const int CHURN_SPIKE_PCT = 30;		// from here on it drops to the minimum and the
+					// next scan starts right away
 
-	// container for parsing the access point's basic service set information (BSS)
-	struct nlattr* bss[NL80211_BSS_MAX + 1];
+// Returns the interval after a cycle. rescan is set if the next scan is to start
+// right away, which is never done twice in a row. Interfaces that have no
+// previous dump to compare with, or whose scan failed, do not count.
+static long adapt_interval(const struct scan_ctx* ctx, const struct scan_options* opts, long interval,
+	bool* rescan) {
 
-	// container specifying the types and lengths of data to be parsed from the netlink
-	// message, I think. The whole message parsing side of netlink is confusing.
-	struct nla_policy bss_policy[NL80211_BSS_MAX + 1];
+	long changed = 0;
+	long total = 0;
+	bool valid = false;
 
-	memset(bss_policy, 0, sizeof(bss_policy));
-	memset(bss, 0, sizeof(bss));
-	memset(tb, 0, sizeof(tb));
+	for (int i = 0; i < ctx->ntargets; i++) {
+		const struct scan_target* target = &ctx->targets[i];
 
-	bss_policy[NL80211_BSS_TSF] = { .type = NLA_U64 };
-	bss_policy[NL80211_BSS_FREQUENCY] = { .type = NLA_U32 },
-	bss_policy[NL80211_BSS_BSSID] = { };
-	bss_policy[NL80211_BSS_BEACON_INTERVAL] = { .type = NLA_U16 };
-	bss_policy[NL80211_BSS_CAPABILITY] = { .type = NLA_U16 };
-	bss_policy[NL80211_BSS_INFORMATION_ELEMENTS] = { };
-	bss_policy[NL80211_BSS_SIGNAL_MBM] = { .type = NLA_U32 };
-	bss_policy[NL80211_BSS_SIGNAL_UNSPEC] = { .type = NLA_U8 };
-	bss_policy[NL80211_BSS_STATUS] = { .type = NLA_U32 };
-	bss_policy[NL80211_BSS_SEEN_MS_AGO] = { .type = NLA_U32 };
-	bss_policy[NL80211_BSS_BEACON_IES] = { };
-	bool is_dmg = false;
+		if (target->state != TARGET_DONE || !target->churn.valid)
+			continue;
 
-	int err = nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
-	if (err < 0) {
-		printf("error creating attribute indices from scan message: %d, %s\n", err, nl_geterror(err));
-		return NL_SKIP;
+		valid = true;
+		changed += target->churn.added + target->churn.removed + target->churn.moved;
+		total += target->churn.bsses + target->churn.removed;
 	}
 
-	if (!tb[NL80211_ATTR_BSS]) {
-		printf("bss info missing\n");
-		return NL_SKIP;
-	}
+	bool rescanned = *rescan;
+	*rescan = false;
+	if (!valid)
+		return interval;
 
-	// BSS information is a nested attribute, so a second parse call is needed
-	err = nla_parse_nested(bss, NL80211_BSS_MAX, tb[NL80211_ATTR_BSS], bss_policy);
-	if (err < 0) {
-		printf("failed to parse nested attributes: %d, %s\n", err, nl_geterror(err));
-		return NL_SKIP;
-	}
+	long pct = total > 0 ? changed * 100 / total : 0;
 
-	// If BSSID or IE is missing, we can't parse anything beyond this point
-	if (!bss[NL80211_BSS_BSSID] || !bss[NL80211_BSS_INFORMATION_ELEMENTS]) {
-		return NL_SKIP;
+	if (pct >= CHURN_SPIKE_PCT) {
+		*rescan = !rescanned;
+		interval = opts->interval_min_ms;
+	} else if (pct >= CHURN_BUSY_PCT) {
+		interval /= 2;
+	} else if (pct < CHURN_QUIET_PCT) {
+		interval += interval / 4 > 0 ? interval / 4 : 1;
 	}
 
-	memset(current_mac, '\0', sizeof(current_mac));
-	mac_addr_n2a(current_mac, (unsigned char*)nla_data(bss[NL80211_BSS_BSSID]));
+	if (interval < opts->interval_min_ms)
+		interval = opts->interval_min_ms;
+	if (interval > opts->interval_max_ms)
+		interval = opts->interval_max_ms;
+	return interval;
+}
+
+const int DEFAULT_ACK_TIMEOUT_MS = 2000;
+const int DEFAULT_SCAN_TIMEOUT_MS = 30000;
+const int DEFAULT_DUMP_TIMEOUT_MS = 5000;
+const int DEFAULT_DIFF_HYSTERESIS = 300;
+const int DEFAULT_DUMP_RESTARTS = 3;
+const int DEFAULT_RETRY_BACKOFF_MS = 100;
+const int DEFAULT_RETRY_BACKOFF_MAX_MS = 2000;
+const int MIN_RECV_BUFFER = 4096;
+
+// getopt_long() values of the options that have no short form
+enum {
+	OPT_ACK_TIMEOUT = 256,
+	OPT_SCAN_TIMEOUT,
+	OPT_DUMP_TIMEOUT,
+	OPT_ALL,
+	OPT_PASSIVE,
+	OPT_FREQ,
+	OPT_SSID,
+	OPT_DURATION,
+	OPT_SCAN_FLAGS,
+	OPT_DIFF,
+	OPT_DIFF_HYSTERESIS,
+	OPT_FORMAT,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_REPLAY_REALTIME,
+	OPT_RECV_BUFFER,
+	OPT_RECV_PEEK,
+	OPT_SOCKET_BUFFER,
+	OPT_DUMP_RESTARTS,
+	OPT_SCHED,
+	OPT_SCHED_SSID,
+	OPT_SCHED_RSSI,
+	OPT_SHM,
+	OPT_SERVE,
+	OPT_STATS,
+	OPT_PROMETHEUS,
+	OPT_RETRY,
+	OPT_RETRY_BACKOFF,
+	OPT_CACHE_FALLBACK,
+	OPT_MAX_AGE,
+	OPT_INTERVAL_MIN,
+	OPT_INTERVAL_MAX,
+	OPT_SPLIT,
+	OPT_MIN_SIGNAL,
+	OPT_MATCH_SSID,
+	OPT_BAND,
+	OPT_SECURITY,
+	OPT_FIELDS,
+};
 
-	printf("%s%s\n", DISCOVER_STR, current_mac);
+static void usage(const char* progname) {
+	printf("usage: %s [options] wifi_adapter_name [wifi_adapter_name...]\nie: %s wlp2s0.\n"
+		"       %s [options] --replay <file>\n\n"
+		"options:\n"
+		"  --all                scan all wifi interfaces (one per radio)\n"
+		"  -i, --interval <ms>  keep running and start a new scan every <ms> milliseconds\n"
+		"  --interval-min <ms>\n"
+		"  --interval-max <ms>  let the interval adapt between these bounds (default: the --interval):\n"
+		"                       shorter while access points appear, disappear or change their\n"
+		"                       signal, longer while nothing changes\n"
+		"  --split <n>          in interval mode, scan only <n> channels per scan and the next ones\n"
+		"                       in the scans after, but print the access points of all channels\n"
+		"  -c, --count <n>      stop after <n> scans in interval, passive or scheduled scan mode\n"
+		"                       (default: run forever)\n"
+		"  --passive            never scan, print the results whenever another process' scan completes\n"
+		"  --sched <ms>         let the firmware scan every <ms> milliseconds and print the results\n"
+		"                       whenever it finds a match (scheduled scan)\n"
+		"  --sched-ssid <ssid>  only report scheduled scan matches for this SSID (can be given more\n"
+		"                       than once)\n"
+		"  --sched-rssi <dBm>   only report scheduled scan matches at least this strong\n"
+		"  --ack-timeout <ms>   time to wait for the scan request to be acknowledged (default: %d)\n"
+		"  --scan-timeout <ms>  time to wait for the scan to complete (default: %d)\n"
+		"  --dump-timeout <ms>  time to wait for the scan results (default: %d)\n"
+		"                       0 waits forever, a timeout exits with ETIMEDOUT (110)\n"
+		"  --retry <ms>         retry a scan that was rejected as busy or aborted for up to <ms>\n"
+		"                       milliseconds (default: 0, no retries)\n"
+		"  --retry-backoff <ms> first delay between retries, it doubles up to %d ms and is\n"
+		"                       randomized (default: %d)\n"
+		"  --cache-fallback <ms>\n"
+		"                       when a scan could not be done, print the access points the kernel\n"
+		"                       has seen in the last <ms> milliseconds instead of failing\n"
+		"  --max-age <ms>       print the access points the kernel has seen instead of scanning\n"
+		"                       as long as they are at most <ms> milliseconds old; with --freq\n"
+		"                       only the channels without such access points are scanned\n"
+		"  --freq <MHz>[,<MHz>...]\n"
+		"                       only scan these channels (can be given more than once)\n"
+		"  --ssid <ssid>        send probe requests for this SSID instead of the wildcard SSID\n"
+		"                       (can be given more than once)\n"
+		"  --duration <TU>      dwell time on each channel in TUs (1024 us), if the driver supports it\n"
+		"  --scan-flags <flag>[,<flag>...]\n"
+		"                       low-priority, flush, and one of low-span, low-power, high-accuracy;\n"
+		"                       flags the driver does not support are ignored\n"
+		"  --min-signal <dBm>   only print access points at least this strong\n"
+		"  --match-ssid <glob>  only print access points whose SSID matches the shell pattern <glob>\n"
+		"                       (can be given more than once)\n"
+		"  --band <band>[,<band>...]\n"
+		"                       only print access points in these bands: 2.4, 5, 6, 60\n"
+		"  --security <kind>[,<kind>...]\n"
+		"                       only print access points with one of these: open, wep, psk, sae,\n"
+		"                       eap, owe\n"
+		"  --fields <field>[,<field>...]\n"
+		"                       only print these data lines, e.g. bss.signal,bss.ssid,rsn.akm\n"
+		"                       (see the README for the names); elements without a selected\n"
+		"                       line are not decoded\n"
+		"  --diff               in interval, passive or scheduled scan mode or on a replay, only\n"
+		"                       print what changed since the previous scan (AP_NEW, AP_CHANGED\n"
+		"                       and AP_GONE)\n"
+		"  --diff-hysteresis <mBm>\n"
+		"                       smallest signal strength change that is reported (default: %d)\n"
+		"  --format <format>    text (default), json (one object per line) or tlv (binary)\n"
+		"  --record <file>      write the raw netlink messages of the scans to <file>\n"
+		"  --replay <file>      print the results of a recording instead of scanning\n"
+		"  --replay-realtime    replay at the recorded pace instead of as fast as possible\n"
+		"  --recv-buffer <bytes>\n"
+		"                       initial size of the receive buffer (default: 32768), it grows when\n"
+		"                       a larger datagram arrives\n"
+		"  --recv-peek          look at the size of every datagram first, so that none is ever\n"
+		"                       truncated (one more system call per datagram)\n"
+		"  --socket-buffer <bytes>\n"
+		"                       size of the socket receive queue (default: system default)\n"
+		"  --dump-restarts <n>  how often an interrupted scan dump is restarted (default: %d)\n"
+		"  --shm <file>         publish the access points of the last scan in <file> for other\n"
+		"                       processes, e.g. /dev/shm/ap-scanner (see apscanner_shm.h)\n"
+		"  --serve <socket>     in interval, passive or scheduled scan mode, answer queries about\n"
+		"                       the access points of the last scans on a Unix socket\n"
+		"  --stats              at exit, print how long the phases of the scans took\n"
+		"  --prometheus <file>  in interval, passive or scheduled scan mode, keep the statistics in\n"
+		"                       <file> in the Prometheus text format, rewritten after every scan\n"
+		"  -h, --help           print this help\n",
+		progname, progname, progname, DEFAULT_ACK_TIMEOUT_MS, DEFAULT_SCAN_TIMEOUT_MS, DEFAULT_DUMP_TIMEOUT_MS,
+		DEFAULT_RETRY_BACKOFF_MAX_MS, DEFAULT_RETRY_BACKOFF_MS, DEFAULT_DIFF_HYSTERESIS, DEFAULT_DUMP_RESTARTS);
+}
+
+// Parses a non-negative integer option value, returns -1 on error
+static long parse_ms(const char* arg) {
+	char* end = NULL;
 
-	if (bss[NL80211_BSS_SIGNAL_MBM]) {
-		dataline();
-		printf("signal strength:%d mBm\n", nla_get_u32(bss[NL80211_BSS_SIGNAL_MBM]));
-	} else if (bss[NL80211_BSS_SIGNAL_UNSPEC]) {
-		dataline();
-		printf("signal strength:%d units\n", nla_get_u8(bss[NL80211_BSS_SIGNAL_UNSPEC]));
+	errno = 0;
+	long value = strtol(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || value < 0) {
+		return -1;
 	}
 
-	if (bss[NL80211_BSS_FREQUENCY]) {
-		int freq = nla_get_u32(bss[NL80211_BSS_FREQUENCY]);
+	return value;
+}
 
-		dataline();
-		int freq_offset = bss[NL80211_BSS_FREQUENCY_OFFSET] ? nla_get_u32(bss[NL80211_BSS_FREQUENCY_OFFSET]) : 0;
-		if (freq_offset > 0)
-			printf("frequency:%d.%d MHz\n", freq, freq_offset);
-		else
-			printf("frequency:%d MHz\n", freq);
+// Adds a comma separated list of frequencies in MHz, returns non-zero on error
+static int parse_freqs(const char* arg, struct scan_params* params) {
+	const char* p = arg;
 
-		if (freq > 45000)
-			is_dmg = true;
-	}
+	while (*p) {
+		char* end = NULL;
 
-	if (bss[NL80211_BSS_CAPABILITY]) {
-		__u16 capa = nla_get_u16(bss[NL80211_BSS_CAPABILITY]);
-		bool first = true;
-		dataline();
-		printf("capabilities:");
-		if (is_dmg)
-			print_capa_dmg(capa, &first);
-		else
-			print_capa_non_dmg(capa, &first);
-		
-		sep_if_not_first(&first);
-		printf("(0x%.4x)\n", capa);
+		errno = 0;
+		long freq = strtol(p, &end, 10);
+		if (errno != 0 || end == p || freq <= 0 || freq > 100000 ||
+			(*end != ',' && *end != '\0') || params->nfreqs >= MAX_SCAN_FREQS)
+			return 1;
+
+		params->freqs[params->nfreqs++] = (__u32)freq;
+		p = *end == ',' ? end + 1 : end;
 	}
 
-	// Information element parsing is based entirely on iw source code. There's a ton of undocumented
-	// magic values going around, and I didn't really get an understanding how IE is bundled into
-	// scan responses, but it seems to be binary data of custom structure.	
-	if (bss[NL80211_BSS_INFORMATION_ELEMENTS]) {
+	return 0;
+}
+
+// A name of a comma separated list and the bit it sets, tables end with a NULL name
+struct name_bit {
+	const char* name;
+	unsigned int bit;
+};
+
+// Names of --scan-flags
+static const struct name_bit scan_flag_names[] = {
+	{ "low-priority", NL80211_SCAN_FLAG_LOW_PRIORITY },
+	{ "flush", NL80211_SCAN_FLAG_FLUSH },
+	{ "low-span", NL80211_SCAN_FLAG_LOW_SPAN },
+	{ "low-power", NL80211_SCAN_FLAG_LOW_POWER },
+	{ "high-accuracy", NL80211_SCAN_FLAG_HIGH_ACCURACY },
+	{ NULL, 0 }
+};
 
-		struct nlattr* ies = bss[NL80211_BSS_INFORMATION_ELEMENTS];
-		struct nlattr* bcnies = bss[NL80211_BSS_BEACON_IES];
+// Adds the bits of a comma separated list of names from a table to bits, returns
+// non-zero if a name is not in the table
+static int parse_name_list(const char* arg, const struct name_bit* names, unsigned int* bits) {
+	const char* p = arg;
 
-		if (bss[NL80211_BSS_PRESP_DATA] || (bcnies && (nla_len(ies) != nla_len(bcnies) ||
-			memcmp(nla_data(ies), nla_data(bcnies), nla_len(ies))))) {
+	while (*p) {
+		size_t len = strcspn(p, ",");
+		const struct name_bit* n;
+
+		for (n = names; n->name; n++) {
+			if (strlen(n->name) == len && strncmp(n->name, p, len) == 0)
+				break;
 		}
 
-		print_ies((unsigned char*)nla_data(ies), nla_len(ies));
-	}
+		if (n->name == NULL)
+			return 1;
 
-	// There can be both beacon responses and probe requests in the same scan result, and they
-	// can contain the same data. This can result in duplicates being printed.
-	if (bss[NL80211_BSS_BEACON_IES]) {
-		print_ies((unsigned char*)nla_data(bss[NL80211_BSS_BEACON_IES]), nla_len(bss[NL80211_BSS_BEACON_IES]));
+		*bits |= n->bit;
+		p += p[len] == ',' ? len + 1 : len;
 	}
 
-	printf("\n");
+	return 0;
+}
+
+// Adds a comma separated list of scan flag names, returns non-zero on error
+static int parse_scan_flags(const char* arg, struct scan_params* params) {
+
+	if (parse_name_list(arg, scan_flag_names, &params->flags) != 0)
+		return 1;
 
-	return NL_SKIP;
+	// these select the kind of scan and exclude each other
+	__u32 kind = params->flags & (NL80211_SCAN_FLAG_LOW_SPAN | NL80211_SCAN_FLAG_LOW_POWER |
+		NL80211_SCAN_FLAG_HIGH_ACCURACY);
+	if (kind & (kind - 1))
+		return 1;
+
+	return 0;
 }
 
-int do_scan_trigger(struct nl_sock* socket, int if_index, int family_id) {
+// Names of --band and --security
+static const struct name_bit filter_band_names[] = {
+	{ "2.4", SCAN_BAND_2GHZ },
+	{ "5", SCAN_BAND_5GHZ },
+	{ "6", SCAN_BAND_6GHZ },
+	{ "60", SCAN_BAND_60GHZ },
+	{ NULL, 0 }
+}, filter_security_names[] = {
+	{ "open", SCAN_SECURITY_OPEN },
+	{ "wep", SCAN_SECURITY_WEP },
+	{ "psk", SCAN_SECURITY_PSK },
+	{ "sae", SCAN_SECURITY_SAE },
+	{ "eap", SCAN_SECURITY_EAP },
+	{ "owe", SCAN_SECURITY_OWE },
+	{ NULL, 0 }
+};
 
-	// Starts the scan and waits for it to finish.
-	// Does not return until the scan is done or has been aborted.
+// Names of --fields, a section name selects all of its lines
+static const struct name_bit field_names[] = {
+	{ "bss", FIELD_BSS },
+	{ "bss.interface", FIELD_INTERFACE },
+	{ "bss.signal", FIELD_SIGNAL },
+	{ "bss.frequency", FIELD_FREQUENCY },
+	{ "bss.capabilities", FIELD_CAPABILITIES },
+	{ "bss.ssid", FIELD_SSID },
+	{ "bss.last_seen", FIELD_LAST_SEEN },
+	{ "rsn", RSN_FIELDS << FIELD_RSN_SHIFT },
+	{ "rsn.version", RSN_FIELD_VERSION << FIELD_RSN_SHIFT },
+	{ "rsn.group_cipher", RSN_GROUP_CIPHER << FIELD_RSN_SHIFT },
+	{ "rsn.pairwise", RSN_PAIRWISE << FIELD_RSN_SHIFT },
+	{ "rsn.akm", RSN_AKM << FIELD_RSN_SHIFT },
+	{ "rsn.capabilities", RSN_CAPABILITIES << FIELD_RSN_SHIFT },
+	{ "rsn.pmkid_count", RSN_PMKID_COUNT << FIELD_RSN_SHIFT },
+	{ "rsn.group_mgmt_cipher", RSN_GROUP_MGMT_CIPHER << FIELD_RSN_SHIFT },
+	{ "wpa", RSN_FIELDS << FIELD_WPA_SHIFT },
+	{ "wpa.version", RSN_FIELD_VERSION << FIELD_WPA_SHIFT },
+	{ "wpa.group_cipher", RSN_GROUP_CIPHER << FIELD_WPA_SHIFT },
+	{ "wpa.pairwise", RSN_PAIRWISE << FIELD_WPA_SHIFT },
+	{ "wpa.akm", RSN_AKM << FIELD_WPA_SHIFT },
+	{ "wpa.capabilities", RSN_CAPABILITIES << FIELD_WPA_SHIFT },
+	{ "wpa.pmkid_count", RSN_PMKID_COUNT << FIELD_WPA_SHIFT },
+	{ "wpa.group_mgmt_cipher", RSN_GROUP_MGMT_CIPHER << FIELD_WPA_SHIFT },
+	{ "wps", FIELD_WPS },
+	{ NULL, 0 }
+};
 
-	struct init_scan_results results = { .done = 0, .aborted = 0 };
-	struct nl_msg* msg = NULL;
-	struct nl_msg* ssids_to_scan = NULL;
-	struct nl_cb* cb = NULL;
-	int err;
-	int ret;
-	int mcid = -1;
+// The kinds of elements the printed fields and the query server need
+static unsigned int needed_ies(unsigned int fields, bool serve) {
+	unsigned int kinds = 0;
+
+	if (fields & FIELD_SSID)
+		kinds |= DECODE_SSID;
+	if (fields & RSN_FIELDS << FIELD_RSN_SHIFT)
+		kinds |= DECODE_RSN;
+	if (fields & RSN_FIELDS << FIELD_WPA_SHIFT)
+		kinds |= DECODE_WPA;
+	if (fields & FIELD_WPS)
+		kinds |= DECODE_WPS;
+	// the server indexes the SSID and the suites
+	if (serve)
+		kinds |= DECODE_SSID | DECODE_RSN | DECODE_WPA;
+
+	return kinds;
+}
 
-	std::shared_ptr<void> defer(nullptr, [&](...){
-		if (ssids_to_scan != NULL) {
-			nlmsg_free(ssids_to_scan);
-		}
+int main(int argc, char** argv) {
 
-		if (msg != NULL) {
-			nlmsg_free(msg);
+	struct scan_options opts = { .ifnames = { NULL }, .nifnames = 0, .all_interfaces = false,
+		.passive = false, .sched = false, .params = { }, .filter = { }, .fields = 0, .diff = false, .diff_hysteresis = DEFAULT_DIFF_HYSTERESIS,
+		.interval_ms = 0, .count = 0, .timeouts = { DEFAULT_ACK_TIMEOUT_MS, DEFAULT_SCAN_TIMEOUT_MS, DEFAULT_DUMP_TIMEOUT_MS },
+		.retry = { 0, DEFAULT_RETRY_BACKOFF_MS, DEFAULT_RETRY_BACKOFF_MAX_MS, 0 },
+		.format = FORMAT_TEXT, .record_path = NULL, .replay_path = NULL, .replay_realtime = false,
+		.buffers = { 0, false, 0, DEFAULT_DUMP_RESTARTS }, .shm_path = NULL,
+		.serve_path = NULL, .stats = false, .prometheus_path = NULL };
+
+	static const struct option long_options[] = {
+		{ "interval", required_argument, NULL, 'i' },
+		{ "count", required_argument, NULL, 'c' },
+		{ "interval-min", required_argument, NULL, OPT_INTERVAL_MIN },
+		{ "interval-max", required_argument, NULL, OPT_INTERVAL_MAX },
+		{ "split", required_argument, NULL, OPT_SPLIT },
+		{ "ack-timeout", required_argument, NULL, OPT_ACK_TIMEOUT },
+		{ "scan-timeout", required_argument, NULL, OPT_SCAN_TIMEOUT },
+		{ "dump-timeout", required_argument, NULL, OPT_DUMP_TIMEOUT },
+		{ "retry", required_argument, NULL, OPT_RETRY },
+		{ "retry-backoff", required_argument, NULL, OPT_RETRY_BACKOFF },
+		{ "cache-fallback", required_argument, NULL, OPT_CACHE_FALLBACK },
+		{ "max-age", required_argument, NULL, OPT_MAX_AGE },
+		{ "all", no_argument, NULL, OPT_ALL },
+		{ "passive", no_argument, NULL, OPT_PASSIVE },
+		{ "sched", required_argument, NULL, OPT_SCHED },
+		{ "sched-ssid", required_argument, NULL, OPT_SCHED_SSID },
+		{ "sched-rssi", required_argument, NULL, OPT_SCHED_RSSI },
+		{ "freq", required_argument, NULL, OPT_FREQ },
+		{ "ssid", required_argument, NULL, OPT_SSID },
+		{ "duration", required_argument, NULL, OPT_DURATION },
+		{ "scan-flags", required_argument, NULL, OPT_SCAN_FLAGS },
+		{ "min-signal", required_argument, NULL, OPT_MIN_SIGNAL },
+		{ "match-ssid", required_argument, NULL, OPT_MATCH_SSID },
+		{ "band", required_argument, NULL, OPT_BAND },
+		{ "security", required_argument, NULL, OPT_SECURITY },
+		{ "fields", required_argument, NULL, OPT_FIELDS },
+		{ "diff", no_argument, NULL, OPT_DIFF },
+		{ "diff-hysteresis", required_argument, NULL, OPT_DIFF_HYSTERESIS },
+		{ "format", required_argument, NULL, OPT_FORMAT },
+		{ "record", required_argument, NULL, OPT_RECORD },
+		{ "replay", required_argument, NULL, OPT_REPLAY },
+		{ "replay-realtime", no_argument, NULL, OPT_REPLAY_REALTIME },
+		{ "recv-buffer", required_argument, NULL, OPT_RECV_BUFFER },
+		{ "recv-peek", no_argument, NULL, OPT_RECV_PEEK },
+		{ "socket-buffer", required_argument, NULL, OPT_SOCKET_BUFFER },
+		{ "dump-restarts", required_argument, NULL, OPT_DUMP_RESTARTS },
+		{ "shm", required_argument, NULL, OPT_SHM },
+		{ "serve", required_argument, NULL, OPT_SERVE },
+		{ "stats", no_argument, NULL, OPT_STATS },
+		{ "prometheus", required_argument, NULL, OPT_PROMETHEUS },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "i:c:h", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'i':
+			opts.interval_ms = parse_ms(optarg);
+			if (opts.interval_ms <= 0) {
+				printf("invalid interval: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_INTERVAL_MIN:
+		case OPT_INTERVAL_MAX: {
+			long ms = parse_ms(optarg);
+			if (ms <= 0) {
+				printf("invalid interval bound: %s\n", optarg);
+				return 1;
+			}
+			if (opt == OPT_INTERVAL_MIN)
+				opts.interval_min_ms = ms;
+			else
+				opts.interval_max_ms = ms;
+			break;
 		}
-
-		if (cb != NULL) {
-			nl_cb_put(cb);
+		case OPT_SPLIT: {
+			long n = parse_ms(optarg);
+			if (n <= 0 || n > INT_MAX) {
+				printf("invalid number of channels: %s\n", optarg);
+				return 1;
+			}
+			opts.split_channels = (int)n;
+			break;
 		}
-
-		if (mcid >= 0) {
-			nl_socket_drop_membership(socket, mcid);
+		case 'c':
+			opts.count = parse_ms(optarg);
+			if (opts.count < 0) {
+				printf("invalid count: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_ACK_TIMEOUT:
+		case OPT_SCAN_TIMEOUT:
+		case OPT_DUMP_TIMEOUT: {
+			long timeout = parse_ms(optarg);
+			if (timeout < 0) {
+				printf("invalid timeout: %s\n", optarg);
+				return 1;
+			}
+			if (opt == OPT_ACK_TIMEOUT)
+				opts.timeouts.ack_ms = timeout;
+			else if (opt == OPT_SCAN_TIMEOUT)
+				opts.timeouts.scan_ms = timeout;
+			else
+				opts.timeouts.dump_ms = timeout;
+			break;
 		}
-	});
-
-	mcid = genl_ctrl_resolve_grp(socket, "nl80211", "scan");
+		case OPT_RETRY:
+			opts.retry.deadline_ms = parse_ms(optarg);
+			if (opts.retry.deadline_ms < 0) {
+				printf("invalid retry time: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_RETRY_BACKOFF:
+			opts.retry.initial_ms = parse_ms(optarg);
+			if (opts.retry.initial_ms <= 0) {
+				printf("invalid retry backoff: %s\n", optarg);
+				return 1;
+			}
+			if (opts.retry.max_ms < opts.retry.initial_ms)
+				opts.retry.max_ms = opts.retry.initial_ms;
+			break;
+		case OPT_CACHE_FALLBACK:
+			opts.retry.cache_age_ms = parse_ms(optarg);
+			if (opts.retry.cache_age_ms <= 0) {
+				printf("invalid cache age: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_MAX_AGE:
+			opts.max_age_ms = parse_ms(optarg);
+			if (opts.max_age_ms <= 0) {
+				printf("invalid maximum age: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_ALL:
+			opts.all_interfaces = true;
+			break;
+		case OPT_PASSIVE:
+			opts.passive = true;
+			break;
+		case OPT_SCHED: {
+			long interval = parse_ms(optarg);
+			if (interval <= 0 || interval > 0xffffffffL) {
+				printf("invalid scheduled scan interval: %s\n", optarg);
+				return 1;
+			}
+			opts.sched = true;
+			opts.params.sched_interval_ms = (__u32)interval;
+			break;
+		}
+		case OPT_SCHED_SSID:
+			if (strlen(optarg) > 32 || opts.params.nmatch_ssids >= MAX_MATCH_SETS) {
+				printf("invalid ssid or too many ssids: %s\n", optarg);
+				return 1;
+			}
+			opts.params.match_ssids[opts.params.nmatch_ssids++] = optarg;
+			break;
+		case OPT_SCHED_RSSI: {
+			char* end = NULL;
+			errno = 0;
+			long rssi = strtol(optarg, &end, 10);
+			if (errno != 0 || end == optarg || *end != '\0' || rssi >= 0 || rssi < -127) {
+				printf("invalid signal strength: %s (dBm, e.g. -70)\n", optarg);
+				return 1;
+			}
+			opts.params.match_rssi = (int)rssi;
+			break;
+		}
+		case OPT_FREQ:
+			if (parse_freqs(optarg, &opts.params) != 0) {
+				printf("invalid frequency list: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_SSID:
+			if (strlen(optarg) > 32 || opts.params.nssids >= MAX_SCAN_SSIDS) {
+				printf("invalid ssid or too many ssids: %s\n", optarg);
+				return 1;
+			}
+			opts.params.ssids[opts.params.nssids++] = optarg;
+			break;
+		case OPT_MIN_SIGNAL: {
+			char* end = NULL;
+			errno = 0;
+			long dbm = strtol(optarg, &end, 10);
+			if (errno != 0 || end == optarg || *end != '\0' || dbm >= 0 || dbm < -127) {
+				printf("invalid signal strength: %s (dBm, e.g. -70)\n", optarg);
+				return 1;
+			}
+			opts.filter.min_signal_mbm = (int)dbm * 100;
+			break;
+		}
+		case OPT_MATCH_SSID:
+			if (opts.filter.nssid_globs >= MAX_FILTER_SSIDS) {
+				printf("too many ssid patterns: %s\n", optarg);
+				return 1;
+			}
+			opts.filter.ssid_globs[opts.filter.nssid_globs++] = optarg;
+			break;
+		case OPT_BAND:
+			if (parse_name_list(optarg, filter_band_names, &opts.filter.bands) != 0) {
+				printf("invalid band list: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_SECURITY:
+			if (parse_name_list(optarg, filter_security_names, &opts.filter.security) != 0) {
+				printf("invalid security list: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_FIELDS:
+			if (parse_name_list(optarg, field_names, &opts.fields) != 0) {
+				printf("invalid field list: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_DURATION: {
+			long duration = parse_ms(optarg);
+			if (duration <= 0 || duration > 0xffff) {
+				printf("invalid duration: %s\n", optarg);
+				return 1;
+			}
+			opts.params.duration_tu = (__u16)duration;
+			break;
+		}
+		case OPT_DIFF:
+			opts.diff = true;
+			break;
+		case OPT_DIFF_HYSTERESIS:
+			opts.diff_hysteresis = (int)parse_ms(optarg);
+			if (opts.diff_hysteresis < 0) {
+				printf("invalid hysteresis: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_SCAN_FLAGS:
+			if (parse_scan_flags(optarg, &opts.params) != 0) {
+				printf("invalid scan flags: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_FORMAT:
+			if (strcmp(optarg, "text") == 0) {
+				opts.format = FORMAT_TEXT;
+			} else if (strcmp(optarg, "json") == 0) {
+				opts.format = FORMAT_JSON;
+			} else if (strcmp(optarg, "tlv") == 0) {
+				opts.format = FORMAT_TLV;
+			} else {
+				printf("invalid format: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_RECORD:
+			opts.record_path = optarg;
+			break;
+		case OPT_REPLAY:
+			opts.replay_path = optarg;
+			break;
+		case OPT_REPLAY_REALTIME:
+			opts.replay_realtime = true;
+			break;
+		case OPT_RECV_BUFFER:
+		case OPT_SOCKET_BUFFER: {
+			long size = parse_ms(optarg);
+			if (size < MIN_RECV_BUFFER || size > INT_MAX / 2) {
+				printf("invalid buffer size: %s (at least %d bytes)\n", optarg, MIN_RECV_BUFFER);
+				return 1;
+			}
+			if (opt == OPT_RECV_BUFFER)
+				opts.buffers.recv_size = (int)size;
+			else
+				opts.buffers.socket_size = (int)size;
+			break;
+		}
+		case OPT_RECV_PEEK:
+			opts.buffers.recv_peek = true;
+			break;
+		case OPT_DUMP_RESTARTS:
+			opts.buffers.max_dump_restarts = (int)parse_ms(optarg);
+			if (opts.buffers.max_dump_restarts < 0 || opts.buffers.max_dump_restarts > 100) {
+				printf("invalid number of dump restarts: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case OPT_SHM:
+			opts.shm_path = optarg;
+			break;
+		case OPT_SERVE:
+			opts.serve_path = optarg;
+			break;
+		case OPT_STATS:
+			opts.stats = true;
+			break;
+		case OPT_PROMETHEUS:
+			opts.prometheus_path = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
 
-	if (mcid < 0) {
-		printf("error resolving netlink group name to identifier: %d, %s\n",
-			mcid, nl_geterror(err));
+	if (opts.replay_path && (optind < argc || opts.all_interfaces || opts.passive || opts.sched ||
+		opts.interval_ms > 0 || opts.record_path)) {
+		printf("--replay cannot be combined with interfaces, --all, --passive, --sched, --interval or --record\n");
 		return 1;
 	}
 
-	// join the netlink socket into the scan group resolved above
-	err = nl_socket_add_membership(socket, mcid);
-	if (err < 0) {
-		printf("error joining scan group: %d, %s\n", err, nl_geterror(err));
+	if (optind >= argc && !opts.all_interfaces && !opts.replay_path) {
+		usage(argv[0]);
 		return 1;
 	}
 
-	// Allocate netlink messages with the default size
-	msg = nlmsg_alloc();
-	ssids_to_scan = nlmsg_alloc();
-
-	if (msg == NULL || ssids_to_scan == NULL) {
-		printf("Failed allocating netlink message\n");
+	if (optind < argc && opts.all_interfaces) {
+		printf("--all cannot be combined with interface names\n");
 		return 1;
 	}
 
-	// allocate a callback handle with default quiet callback type
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-
-	if (!cb) {
-		printf("Failed allocating callback\n");
+	if (opts.passive && opts.interval_ms > 0) {
+		printf("--passive cannot be combined with --interval\n");
 		return 1;
 	}
 
-	// Setup the messages and callback handler.
-
-	// Construct message header
-	// I think this function returns something relevant only if the user_header parameter
-	// is specified as non-zero? I have no idea.
-	genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, family_id, 0, 0, NL80211_CMD_TRIGGER_SCAN, 0);
-
-	// Add message attribute specifying which interface to use.
-	nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index);
-
-	// Scan all SSIDs
-	// TODO: what are these values?
-	nla_put(ssids_to_scan, 1, 0, "");
-
-	// Add message attribute specifiying which SSIDs to scan for
-	nla_put_nested(msg, NL80211_ATTR_SCAN_SSIDS, ssids_to_scan);
-
-	// Copied to msg above, no longer need this
-	nlmsg_free(ssids_to_scan);
-	ssids_to_scan = NULL;
-
-	// Add callbacks - apparently the same callback handle is used for all of them?
-	ret = nl_cb_err(cb, NL_CB_CUSTOM, error_handler, &err);
-	if (ret < 0) {
-		printf("Failed setting NL_CB_CUSTOM callback: %d, %s\n", ret, nl_geterror(ret));;
+	if (opts.sched && (opts.passive || opts.interval_ms > 0)) {
+		printf("--sched cannot be combined with --passive or --interval\n");
 		return 1;
 	}
 
-	ret = nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, scan_finished_cb, &results);
-	if (ret < 0) {
-		printf("Failed setting NL_CB_VALID callback: %d, %s\n", ret, nl_geterror(ret));
+	if ((opts.passive || opts.sched) && (opts.retry.deadline_ms > 0 || opts.retry.cache_age_ms > 0)) {
+		printf("--retry and --cache-fallback cannot be combined with --passive or --sched\n");
 		return 1;
 	}
 
-	ret = nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, finish_handler, &err);
-	if (ret < 0) {
-		printf("Failed setting NL_CB_FINISH callback: %d, %s\n", ret, nl_geterror(ret));
+	if ((opts.passive || opts.sched) && opts.max_age_ms > 0) {
+		printf("--max-age cannot be combined with --passive or --sched\n");
 		return 1;
 	}
 
-	ret = nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, ack_handler, &err);
-	if (ret < 0) {
-		printf("Failed setting NL_CB_ACK callback: %d, %s\n", ret, nl_geterror(ret));
+	if (!opts.sched && (opts.params.nmatch_ssids > 0 || opts.params.match_rssi != 0)) {
+		printf("--sched-ssid and --sched-rssi need --sched\n");
 		return 1;
 	}
 
-	// No sequence checking for multicast messages
-	ret = nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, no_seq_check, NULL);
-	if (ret < 0) {
-		printf("Failed setting NL_CB_SEQ_CHECK callback: %d, %s\n", ret, nl_geterror(ret));
+	if ((opts.interval_min_ms > 0 || opts.interval_max_ms > 0) && opts.interval_ms == 0) {
+		printf("--interval-min and --interval-max need --interval\n");
+		return 1;
+	}
+	if (opts.interval_min_ms == 0)
+		opts.interval_min_ms = opts.interval_ms;
+	if (opts.interval_max_ms == 0)
+		opts.interval_max_ms = opts.interval_ms;
+	if (opts.interval_min_ms > opts.interval_ms || opts.interval_max_ms < opts.interval_ms) {
+		printf("--interval must lie between --interval-min and --interval-max\n");
 		return 1;
 	}
 
-	// reset error flag
-	err = 1;
-
-	// Send NL80211_CMD_TRIGGER_SCAN to start the scan.
-	// The kernel may reply with NL80211_CMD_NEW_SCAN_RESULTS on success or
-	// NL80211_CMD_SCAN_ABORTED if another scan was started by another process.
-
-	int written = nl_send_auto(socket, msg);
-	if (written < 0) {
-		printf("error in nl_send_auto: %d, %s\n", written, nl_geterror(written));
+	if (opts.split_channels > 0 && (opts.interval_ms == 0 || opts.max_age_ms > 0)) {
+		printf("--split needs --interval and cannot be combined with --max-age\n");
 		return 1;
 	}
 
-	printf("nl_send_auto wrote %d bytes\n", written);
-	printf("Waiting for scan to complete\n");
+	// a single scan has nothing to compare with, a recording has the dumps of a session
+	if (opts.diff && opts.interval_ms == 0 && !opts.passive && !opts.sched && !opts.replay_path) {
+		printf("--diff needs --interval, --passive, --sched or --replay\n");
+		return 1;
+	}
 
-	// wait for NL_CB_ACK|error_handler
-	while (err > 0) {
-		ret = nl_recvmsgs(socket, cb);
-		if (ret < 0) {
-			fprintf(stderr, "nl_recvmsgs returned error: %d, %s\n", ret, nl_geterror(ret));
-			if (err >= 0)
-				return 1;
-			else
-			  	break;
-		}
+	if (opts.serve_path && opts.interval_ms == 0 && !opts.passive && !opts.sched) {
+		printf("--serve needs --interval, --passive or --sched\n");
+		return 1;
 	}
 
-	if (err < 0) {
-		fprintf(stderr, "error flag set during message transmission: %d, %s\n", err, strerror(-err));
-		return err;
+	if (opts.prometheus_path && opts.interval_ms == 0 && !opts.passive && !opts.sched) {
+		printf("--prometheus needs --interval, --passive or --sched\n");
+		return 1;
 	}
 
-	while (results.done != 1) {
-		// Now wait until the scan is done or aborted
-		nl_recvmsgs(socket, cb);
+	for (; optind < argc; optind++) {
+		if (opts.nifnames >= MAX_SCAN_TARGETS) {
+			printf("too many interfaces, at most %d can be scanned\n", MAX_SCAN_TARGETS);
+			return 1;
+		}
+		opts.ifnames[opts.nifnames++] = argv[optind];
 	}
 
-	if (results.aborted == 1) {
-		printf("scan was aborted\n");
-		return 1;
+	memset(current_mac, '\0', sizeof(current_mac));
+
+	out_format = opts.format;
+	if (out_format != FORMAT_TEXT) {
+		// keep the real stdout for the records, messages go to stderr
+		out_fd = dup(STDOUT_FILENO);
+		if (out_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			printf("error redirecting messages to stderr: %d, %s\n", errno, strerror(errno));
+			return 1;
+		}
 	}
 
-	printf("Scan is done\n");
-	return 0;
-}
+	struct scan_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.timeouts = opts.timeouts;
+	ctx.retry = opts.retry;
+	ctx.max_age_ms = opts.max_age_ms;
+	ctx.split_channels = opts.split_channels;
+	ctx.passive = opts.passive;
+	ctx.sched = opts.sched;
+	ctx.params = opts.params;
+	ctx.filter = opts.filter;
+	out_fields = opts.fields ? opts.fields : FIELDS_ALL;
+	ctx.skip_ies = DECODE_ALL & ~needed_ies(out_fields, opts.serve_path != NULL);
+	ctx.diff_hysteresis = opts.diff ? opts.diff_hysteresis : -1;
+	ctx.buffers = opts.buffers;
+	// a single scan has nothing to reuse
+	ctx.use_ie_cache = opts.interval_ms > 0 || opts.passive || opts.sched || opts.replay_path;
+	if (opts.interval_min_ms < opts.interval_max_ms)
+		ctx.churn_signal_mbm = CHURN_SIGNAL_MBM;
+	ctx.bss_cb = print_bss;
+	ctx.bss_cb_arg = &ctx;
+	ctx.log_cb = print_log;
+
+	struct scan_stats stats;
+	memset(&stats, 0, sizeof(stats));
+	if (opts.stats || opts.prometheus_path)
+		ctx.stats = &stats;
 
-int main(int argc, char** argv) {
+	// cleanup when falling out of scope
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		print_counters(&ctx);
+		if (opts.stats)
+			print_stats(&stats);
+		scan_ctx_free(&ctx);
+		if (server)
+			server_close(server);
+	});
 
-	if (argc < 2) {
-		printf("usage: programname wifi_adapter_name\nie: ./programname wlp2s0.\n");
+	if (opts.shm_path && scan_shm_open(&ctx, opts.shm_path) != 0) {
 		return 1;
 	}
 
-	// Specify information element parsers. I don't know where one finds what these
-	// magic values are supposed to be. They are copied from iw source.
-	memset(ieprinters, 0, sizeof(ieprinters));
-	ieprinters[0] = { "SSID", print_ssid, 0, 32 };
-	ieprinters[48] = { "RSN", print_rsn, 2, 255 };
-
-	memset(wifiprinters, 0, sizeof(wifiprinters));
-	wifiprinters[1] = { "WPA", print_wifi_wpa, 2, 255 };
-	//wifiprinters[2] = { "WMM", print_wifi_wmm, 1, 255, };
-	wifiprinters[4] = { "WPS", print_wifi_wps, 0, 255 };
+	if (opts.replay_path) {
+		install_stop_handler(&ctx);
 
-	memset(current_mac, '\0', sizeof(current_mac));
+		int err = do_replay(&ctx, opts.replay_path, opts.replay_realtime);
+		return err == -EINTR ? 0 : -err;
+	}
 
-	const char* ifname = argv[1];
-	printf("Using interface: %s\n", ifname);
+	for (int i = 0; i < opts.nifnames; i++) {
+		if (scan_ctx_add_target(&ctx, opts.ifnames[i]) != 0) {
+			return 1;
+		}
+	}
 
-	int if_index = if_nametoindex(ifname);
-	if (if_index == 0) {
-		printf("error matching interface %s into a real interface: %d, %s\n",
-			ifname, errno, strerror(errno));
+	if (scan_ctx_connect(&ctx) != 0) {
 		return 1;
 	}
 
-	// Allocate a netlink socket
-	struct nl_sock* nlsocket = nl_socket_alloc();
-	if (nlsocket == NULL) {
-		printf("Failed allocating nl socket\n");
+	if (opts.all_interfaces && discover_interfaces(&ctx) != 0) {
 		return 1;
 	}
 
-	struct nl_msg* msg = NULL;
+	for (int i = 0; i < ctx.ntargets; i++) {
+		printf("Using interface: %s\n", ctx.targets[i].ifname);
+	}
 
-	// cleanup when falling out of scope
-	std::shared_ptr<void> defer(nullptr, [&](...){
-		if (nlsocket) {
-			nl_socket_free(nlsocket);
-			nlsocket = NULL;
+	if (ctx.params.flags != 0 || ctx.params.duration_tu > 0) {
+		for (int i = 0; i < ctx.ntargets; i++) {
+			if (query_scan_support(&ctx, &ctx.targets[i]) != 0) {
+				return 1;
+			}
 		}
+	}
 
-		if (msg) {
-			nlmsg_free(msg);
+	if (ctx.split_channels > 0) {
+		for (int i = 0; i < ctx.ntargets; i++) {
+			if (query_scan_channels(&ctx, &ctx.targets[i]) != 0) {
+				return 1;
+			}
 		}
-	});
+	}
 
-	// Connect the allocated socket to libnl
-	int err = genl_connect(nlsocket);
-	if (err < 0) {
-		printf("Error connecting nl socket: %d, %s\n", err, nl_geterror(err));
+	if (opts.record_path && scan_record_open(&ctx, opts.record_path) != 0) {
 		return 1;
 	}
 
-	// Match the nl80211 netlink family name to its identifier
-	int family_id = genl_ctrl_resolve(nlsocket, "nl80211");
-	if (family_id  < 0) {
-		printf("error finding identifier for nl80211 family name: %d, %s\n",
-			family_id, nl_geterror(family_id));
+	if (scan_ctx_init(&ctx) != 0) {
 		return 1;
 	}
 
-	// Issue NL80211_CMD_TRIGGER_SCAN to the kernel and wait for it to finish
-	err = do_scan_trigger(nlsocket, if_index, family_id);
+	if (opts.serve_path) {
+		server = server_open(opts.serve_path, opts.diff);
+		if (server == NULL) {
+			return 1;
+		}
+		ctx.poll_fd = server_fd(server);
+		ctx.poll_cb = server_handle;
+		ctx.poll_cb_arg = server;
+	}
+
+	if (server || opts.prometheus_path) {
+		prometheus_path = opts.prometheus_path;
+		ctx.dump_cb = dump_done;
+		ctx.dump_cb_arg = &ctx;
+	}
 
-	if (err != 0) {
-		printf("do_scan_trigger() failed with %d\n", err);
+	if (opts.passive) {
+		install_stop_handler(&ctx);
+
+		int err = do_passive_listen(&ctx, opts.count);
 		return err > 0 ? err : -err;
 	}
 
-	// get info for all SSIDs detected
+	if (opts.sched) {
+		install_stop_handler(&ctx);
 
-	msg = nlmsg_alloc();
+		int err = do_sched_scan(&ctx, opts.count);
+		return err > 0 ? err : -err;
+	}
 
-	// Setup which command to run
-	genlmsg_put(msg, 0, 0, family_id, 0, NLM_F_DUMP, NL80211_CMD_GET_SCAN, 0);
+	// one-shot mode: scan once and report the error as exit code
+	if (opts.interval_ms == 0) {
 
-	// Add message attribute specifying which interface to use
-	nla_put_u32(msg, NL80211_ATTR_IFINDEX, if_index);
+		// Issue NL80211_CMD_TRIGGER_SCAN to the kernel, wait for it to finish and
+		// print the results
+		int err = do_scan_cycle(&ctx);
 
-	// Add callback for getting data
-	nl_socket_modify_cb(nlsocket, NL_CB_VALID, NL_CB_CUSTOM, receive_scan_result, NULL);
+		if (err != 0) {
+			printf("scan failed with %d\n", err);
+		}
 
-	// Send the message
-	int ret = nl_send_auto(nlsocket, msg);
-	if (ret < 0) {
-		printf("nl_send_auto() failed with: %d, %s\n", ret, nl_geterror(ret));
-		return 1;
+		return err > 0 ? err : -err;
 	}
 
-	// wait for the message to go through
-	ret = nl_recvmsgs_default(nlsocket);
+	// daemon mode: scan every interval_ms until stopped, a failed cycle is reported
+	// but does not end the program
+	install_stop_handler(&ctx);
 
-	// TODO: handle invalid number of bytes written
-	if (ret < 0) {
-		printf("ERROR: nl_recvmsgs_default() failed with %d, %s\n", ret, nl_geterror(ret));
-		return 1;
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	long interval_ms = opts.interval_ms;
+	bool rescan = false;
+
+	for (long cycle = 0; !ctx.stop && (opts.count == 0 || cycle < opts.count); cycle++) {
+
+		if (cycle > 0) {
+			// cycles start interval_ms apart, regardless of how long a scan took
+			long delay_ms = rescan ? 0 : interval_ms;
+			next.tv_sec += delay_ms / 1000;
+			next.tv_nsec += (delay_ms % 1000) * 1000000;
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_sec++;
+				next.tv_nsec -= 1000000000;
+			}
+			// if a scan overran the interval, start right away and keep the new pace
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec > next.tv_sec || (now.tv_sec == next.tv_sec && now.tv_nsec > next.tv_nsec))
+				next = now;
+
+			sleep_until(&ctx, &next);
+			if (ctx.stop)
+				break;
+		}
+
+		int err = do_scan_cycle(&ctx);
+		if (err != 0) {
+			printf("scan failed with %d\n", err);
+		}
+
+		if (err == -EINTR)
+			break;
+
+		if (ctx.churn_signal_mbm > 0) {
+			long adapted = adapt_interval(&ctx, &opts, interval_ms, &rescan);
+			if (rescan)
+				printf("access points changed a lot, scanning again right away\n");
+			if (adapted != interval_ms)
+				printf("scan interval is now %ld ms\n", adapted);
+			interval_ms = adapted;
+		}
+
+		// make each cycle visible immediately when stdout is a pipe
+		fflush(stdout);
 	}
 
 	return 0;
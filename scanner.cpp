@@ -0,0 +1,2844 @@
+/**
+ * Code applied from:
+ * - libnl sources LGPL2.1 https://www.infradead.org/~tgr/libnl/
+ * - example code from Python libnl port (LGPL2.1):
+ *	 https://github.com/Robpol86/libnl/blob/master/example_c/scan_access_points.c
+ * - as well as iw(8) source code (MIT).
+ *   https://git.sipsolutions.net/iw.git/tree/scan.c
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// The nl80211 scan session: triggering scans on the targets of a scan context,
+// waiting for them in a poll() loop and dumping the results.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "apscanner.h"
+#include "apscanner_shm.h"
+
+#define ARRAY_SIZE(ar) (sizeof(ar)/sizeof(ar[0]))
+
+// The kernel never puts more than 32 KiB into one datagram of a dump, the default
+// size of the receive buffer
+const size_t RECV_BUF_SIZE = 32768;
+
+// What was last reported about a BSS in diff mode
+struct bss_entry {
+	int signal;		// mBm, a unit of SIGNAL_UNSPEC drivers counts as 100 mBm
+	__u32 freq;
+	__u32 freq_offset;
+	__u16 capa;
+	__u64 ie_hash;		// hash of the information elements and beacon IEs
+	unsigned int seen;	// last dump that contained the BSS
+};
+
+// BSS table of one interface for diff mode, keyed by BSSID
+struct bss_table {
+	std::unordered_map<__u64, struct bss_entry> entries;
+	unsigned int dump;	// number of the dump in progress
+	int hysteresis;		// signal changes smaller than this (mBm) are not reported
+};
+
+// Last signal of a BSS for counting the churn
+struct churn_entry {
+	int signal;		// mBm, as in bss_entry
+	unsigned int seen;	// last dump that contained the BSS
+};
+
+// BSSes of one interface while churn is counted, keyed by BSSID
+struct churn_table {
+	std::unordered_map<__u64, struct churn_entry> entries;
+	unsigned int dump;	// number of the dump in progress
+};
+
+// A BSS that split channel scanning keeps, with a copy of its last message so that
+// it can be reported while its channel is not scanned
+struct rolling_entry {
+	std::vector<__u8> msg;
+	__u32 freq;
+	long long seen_ms;	// CLOCK_MONOTONIC when it was last received
+	unsigned int dump;	// last dump that contained the BSS
+};
+
+// Split channel scanning of one interface. Every cycle scans the next group of
+// channels, the BSSes of all channels are kept in a rolling table keyed by BSSID.
+struct split_scan {
+	std::vector<__u32> channels;	// MHz, all channels that are scanned in turn
+	size_t next;			// first channel of the next group
+	std::vector<__u32> group;	// channels of the cycle in flight
+	long long group_start_ms;	// CLOCK_MONOTONIC when the group was triggered
+	bool covered;			// the group was scanned, BSSes the scan missed are gone
+	bool replaying;			// BSSes are reported from the table
+	std::unordered_map<__u64, struct rolling_entry> entries;
+	unsigned int dump;		// number of the dump in progress
+};
+
+// Decoded information elements of a BSS, reused as long as its IE bytes do not
+// change so that they are only decoded again when the beacon changes
+struct ie_cache_entry {
+	__u64 ie_hash;
+	unsigned int seen;	// last dump that contained the BSS
+	struct bss_ies elements;
+	bool beacon_differs;
+	struct bss_ies beacon;
+};
+
+// Information element cache of one interface in interval and passive mode, keyed by BSSID
+struct ie_cache {
+	std::unordered_map<__u64, struct ie_cache_entry> entries;
+	unsigned int dump;	// number of the dump in progress
+};
+
+// BSSIDs delivered by the dump in flight. keys[0..sorted) were delivered before
+// the last restart and are sorted for lookup, the later ones are appended.
+struct dump_log {
+	std::vector<__u64> keys;
+	size_t sorted;
+};
+
+// Recording of the raw netlink messages of the scans, see scan_record_open(). The
+// file starts with a record_file_header, followed by records that each consist of a
+// record_header and the data padded to 8 bytes, so that a mapped file can be read
+// in place. All integers are in host byte order, like the netlink messages.
+const char RECORD_MAGIC[8] = { 'A', 'P', 'S', 'C', 'A', 'N', 'R', 'C' };
+const __u32 RECORD_VERSION = 1;
+
+struct record_file_header {
+	char magic[8];
+	__u32 version;
+	__u32 reserved;
+	__u64 start_ns;		// CLOCK_REALTIME of the start of the recording
+};
+
+enum {
+	RECORD_TARGET = 1,	// __u32 ifindex followed by the interface name
+	RECORD_MSG_IN,		// netlink message from the kernel
+	RECORD_MSG_OUT,		// netlink request
+};
+
+struct record_header {
+	__u64 time_ns;		// CLOCK_MONOTONIC since the start of the recording
+	__u32 len;		// of the data, without padding
+	__u16 type;		// RECORD_*
+	__u16 reserved;
+};
+
+struct scan_recording {
+	FILE* file;
+	long long start_ns;	// CLOCK_MONOTONIC
+};
+
+// BSS table published in shared memory, see scan_shm_open() and apscanner_shm.h.
+// Each table of the file holds this many entries.
+const __u32 SHM_CAPACITY = 4096;
+
+static_assert(MAX_SCAN_TARGETS <= APSCAN_SHM_MAX_INTERFACES && IF_NAMESIZE <= APSCAN_SHM_IFNAMSIZ,
+	"the shared memory table cannot name every target");
+
+struct scan_shm {
+	struct apscan_shm_header* hdr;
+	size_t size;
+
+	// BSSes of the last complete dump of every target, and of the dump in flight
+	std::vector<struct apscan_shm_bss> published[MAX_SCAN_TARGETS];
+	std::vector<struct apscan_shm_bss> staged[MAX_SCAN_TARGETS];
+};
+
+static void scan_log(const struct scan_ctx* ctx, const struct scan_target* target, int level,
+	const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+// Passes a message to the log callback. Messages about a target are prefixed with
+// its name when more than one interface is scanned.
+static void scan_log(const struct scan_ctx* ctx, const struct scan_target* target, int level,
+	const char* format, ...) {
+
+	char message[256];
+	int len = 0;
+	va_list ap;
+
+	if (ctx->log_cb == NULL)
+		return;
+
+	if (target != NULL && ctx->ntargets > 1)
+		len = snprintf(message, sizeof(message), "%s: ", target->ifname);
+
+	va_start(ap, format);
+	vsnprintf(message + len, sizeof(message) - len, format, ap);
+	va_end(ap);
+
+	ctx->log_cb(level, message, ctx->log_cb_arg);
+}
+
+static long long monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Wall clock time, for timestamps that other processes read
+static long long realtime_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Adds the duration of a phase to its histogram
+static void stats_add(struct scan_ctx* ctx, int phase, long long ns) {
+	struct scan_histogram* h = &ctx->stats->phases[phase];
+	int i = 0;
+
+	if (ns < 0)
+		ns = 0;
+	while (i < SCAN_HISTOGRAM_BUCKETS - 1 && ns > SCAN_HISTOGRAM_BOUNDS_US[i] * 1000LL)
+		i++;
+	h->buckets[i]++;
+	h->count++;
+	h->sum_ns += ns;
+}
+
+// Takes the time of a message of the dump in flight, NLMSG_DONE included
+static void stats_dump_message(struct scan_ctx* ctx, struct scan_target* target) {
+	long long now = monotonic_ns();
+
+	// a replayed dump was never requested
+	if (target->first_msg_ns == 0 && target->request_ns)
+		stats_add(ctx, PHASE_DUMP_WAIT, now - target->request_ns);
+	if (target->first_msg_ns == 0)
+		target->first_msg_ns = now;
+	target->last_msg_ns = now;
+}
+
+const char* scan_phase_name(int phase) {
+	switch (phase) {
+	case PHASE_ACK:
+		return "ack";
+	case PHASE_SCAN:
+		return "scan";
+	case PHASE_DUMP_WAIT:
+		return "dump_wait";
+	case PHASE_DUMP:
+		return "dump";
+	case PHASE_BSS:
+		return "bss";
+	case PHASE_CYCLE:
+		return "cycle";
+	}
+	return "unknown";
+}
+
+static struct scan_target* target_by_seq(struct scan_ctx* ctx, unsigned int seq) {
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (ctx->targets[i].req_seq == seq && ctx->targets[i].req_status > 0)
+			return &ctx->targets[i];
+	}
+	return NULL;
+}
+
+static struct scan_target* target_by_ifindex(struct scan_ctx* ctx, int if_index) {
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (ctx->targets[i].if_index == if_index)
+			return &ctx->targets[i];
+	}
+	return NULL;
+}
+
+// Error reply to a request
+static void error_handler(struct scan_ctx* ctx, struct nlmsgerr* err) {
+	struct scan_target* target = target_by_seq(ctx, err->msg.nlmsg_seq);
+	if (!target)
+		return;
+
+	target->req_status = err->error;
+	if (target->state == TARGET_TRIGGERED) {
+		target->state = TARGET_FAILED;
+		target->err = err->error;
+		if (ctx->stats && err->error == -EBUSY)
+			ctx->stats->busy++;
+	}
+}
+
+// Marks the dump in flight of a target as incomplete, it is restarted once done
+static void dump_interrupted(struct scan_ctx* ctx, struct scan_target* target) {
+	if (target->dump_intr)
+		return;
+
+	target->dump_intr = true;
+	ctx->counters.dump_intr++;
+}
+
+// NLMSG_DONE at the end of a dump
+static void finish_handler(struct scan_ctx* ctx, struct nlmsghdr* hdr) {
+	struct scan_target* target = target_by_seq(ctx, hdr->nlmsg_seq);
+	if (!target)
+		return;
+
+	if (target->state == TARGET_DUMPING && ctx->stats)
+		stats_dump_message(ctx, target);
+	if (target->state == TARGET_DUMPING && (hdr->nlmsg_flags & NLM_F_DUMP_INTR))
+		dump_interrupted(ctx, target);
+	target->req_status = 0;
+}
+
+// Ack of a request
+static void ack_handler(struct scan_ctx* ctx, struct nlmsghdr* hdr) {
+	struct scan_target* target = target_by_seq(ctx, hdr->nlmsg_seq);
+	if (!target)
+		return;
+
+	target->req_status = 0;
+	// Scan events received before the ack belong to a scan that was started by
+	// another process before ours, they are ignored until this point.
+	if (target->state == TARGET_TRIGGERED) {
+		target->state = TARGET_SCANNING;
+		if (ctx->stats) {
+			target->ack_ns = monotonic_ns();
+			stats_add(ctx, PHASE_ACK, target->ack_ns - target->request_ns);
+		}
+	}
+}
+
+// Error callback of blocking_request()
+static int request_error_handler(struct sockaddr_nl* nla, struct nlmsgerr* err, void* arg) {
+	int* ret = (int*)arg;
+	*ret = err->error;
+	return NL_STOP;
+}
+
+// Callback for NL_CB_ACK and NL_CB_FINISH of blocking_request()
+static int request_done_handler(struct nl_msg* msg, void* arg) {
+	int* ret = (int*)arg;
+	*ret = 0;
+	return NL_STOP;
+}
+
+// Sends a request on the still blocking socket and passes the replies to handler
+// until the kernel acks it or the dump is finished. Used for the queries that
+// are done once at startup, before scan_ctx_init() makes the socket non-blocking.
+// Returns 0 on success or a negative error code.
+static int blocking_request(struct scan_ctx* ctx, struct nl_msg* msg,
+	nl_recvmsg_msg_cb_t handler, void* arg) {
+
+	int err = 1;
+	struct nl_cb* cb = nl_cb_alloc(NL_CB_DEFAULT);
+
+	if (cb == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating callback");
+		return -ENOMEM;
+	}
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		nl_cb_put(cb);
+	});
+
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, handler, arg);
+	nl_cb_err(cb, NL_CB_CUSTOM, request_error_handler, &err);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, request_done_handler, &err);
+	nl_cb_set(cb, NL_CB_ACK, NL_CB_CUSTOM, request_done_handler, &err);
+
+	int ret = nl_send_auto(ctx->socket, msg);
+	if (ret < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "nl_send_auto() failed with: %d, %s", ret, nl_geterror(ret));
+		return -EIO;
+	}
+
+	while (err > 0) {
+		ret = nl_recvmsgs(ctx->socket, cb);
+		if (ret < 0 && err > 0) {
+			scan_log(ctx, NULL, SCAN_LOG_ERROR, "nl_recvmsgs returned error: %d, %s", ret, nl_geterror(ret));
+			return -EIO;
+		}
+	}
+
+	return err;
+}
+
+// Called by the kernel when the scan is done or has been aborted
+static void scan_finished_cb(struct scan_ctx* ctx, struct nlmsghdr* hdr) {
+
+	struct genlmsghdr* gnlh;
+	struct scan_target* target;
+	struct nlattr* ifindex;
+
+	if (!genlmsg_valid_hdr(hdr, 0))
+		return;
+	gnlh = (genlmsghdr*)nlmsg_data(hdr);
+
+	// the scan group carries events of every wifi interface in the system
+	ifindex = nlmsg_find_attr(hdr, GENL_HDRLEN, NL80211_ATTR_IFINDEX);
+	if (!ifindex)
+		return;
+
+	target = target_by_ifindex(ctx, (int)nla_get_u32(ifindex));
+	if (!target)
+		return;
+
+	// a scheduled scan reports with its own event, which only comes when the
+	// firmware found a BSS of the match sets
+	__u8 results = ctx->sched ? NL80211_CMD_SCHED_SCAN_RESULTS : NL80211_CMD_NEW_SCAN_RESULTS;
+
+	if (ctx->sched && gnlh->cmd == NL80211_CMD_SCHED_SCAN_STOPPED && target->state != TARGET_FAILED) {
+		// the driver gave up on the scheduled scan, e.g. because the interface
+		// went down. A dump in flight is finished first.
+		scan_log(ctx, target, SCAN_LOG_ERROR, "scheduled scan was stopped by the driver");
+		target->err = -ECANCELED;
+		if (target->state != TARGET_DUMPING)
+			target->state = TARGET_FAILED;
+		return;
+	}
+
+	if (ctx->passive || ctx->sched) {
+		// a scan of someone else was aborted, keep waiting for the next one
+		if (gnlh->cmd != results)
+			return;
+
+		if (target->state == TARGET_DUMPING)
+			target->rescan_pending = true;
+	}
+
+	if (target->state != TARGET_SCANNING)
+		return;
+
+	if (gnlh->cmd == NL80211_CMD_SCAN_ABORTED) {
+		target->state = TARGET_FAILED;
+		target->err = 1;
+		target->aborted = true;
+		if (ctx->stats)
+			ctx->stats->aborts++;
+	} else if (gnlh->cmd == results) {
+		target->state = TARGET_SCANNED;
+		if (target->split)
+			target->split->covered = true;
+		if (ctx->stats) {
+			long long now = monotonic_ns();
+			if (ctx->passive || ctx->sched)
+				target->cycle_ns = now;
+			else
+				stats_add(ctx, PHASE_SCAN, now - target->ack_ns);
+		}
+	}
+	// else probably an uninteresting multicast message.
+}
+
+static __u64 mac_to_key(const unsigned char* mac) {
+	__u64 key = 0;
+	for (int i = 0; i < 6; i++)
+		key = (key << 8) | mac[i];
+	return key;
+}
+
+static void key_to_mac(__u64 key, unsigned char* mac) {
+	for (int i = 5; i >= 0; i--) {
+		mac[i] = key & 0xff;
+		key >>= 8;
+	}
+}
+
+// Compares a BSS with what was last reported about it and records the new
+// state. Returns the BSS_* flags of the things that have to be reported.
+static int diff_bss(struct bss_table* table, const struct bss_record* bss) {
+
+	struct bss_entry now;
+	int changes = 0;
+
+	memset(&now, 0, sizeof(now));
+
+	if (bss->has_signal_mbm)
+		now.signal = bss->signal_mbm;
+	else if (bss->has_signal_unspec)
+		now.signal = bss->signal_unspec * 100;
+
+	now.freq = bss->freq;
+	now.freq_offset = bss->freq_offset;
+	now.capa = bss->capability;
+	now.ie_hash = bss->ie_hash;
+
+	now.seen = table->dump;
+
+	__u64 key = mac_to_key(bss->bssid);
+	auto it = table->entries.find(key);
+
+	if (it == table->entries.end()) {
+		table->entries[key] = now;
+		return BSS_ALL;
+	}
+
+	struct bss_entry* last = &it->second;
+	last->seen = now.seen;
+
+	// the last reported signal is kept, so that a slow drift is reported once
+	// it adds up to the hysteresis
+	if (abs(now.signal - last->signal) >= table->hysteresis && now.signal != last->signal) {
+		changes |= BSS_SIGNAL;
+		last->signal = now.signal;
+	}
+	if (now.freq != last->freq || now.freq_offset != last->freq_offset) {
+		changes |= BSS_FREQ;
+		last->freq = now.freq;
+		last->freq_offset = now.freq_offset;
+	}
+	if (now.capa != last->capa) {
+		changes |= BSS_CAPA;
+		last->capa = now.capa;
+	}
+	if (now.ie_hash != last->ie_hash) {
+		changes |= BSS_IES;
+		last->ie_hash = now.ie_hash;
+	}
+
+	return changes;
+}
+
+// Reports and forgets the BSSes of a diff table that were not in the last dump
+static void report_gone_bss(struct scan_ctx* ctx, struct scan_target* target) {
+
+	struct bss_table* table = target->table;
+	struct bss_record gone;
+
+	memset(&gone, 0, sizeof(gone));
+	gone.ifname = target->ifname;
+	gone.changes = BSS_GONE;
+
+	for (auto it = table->entries.begin(); it != table->entries.end(); ) {
+		if (it->second.seen == table->dump) {
+			++it;
+			continue;
+		}
+
+		key_to_mac(it->first, gone.bssid);
+		if (ctx->bss_cb)
+			ctx->bss_cb(&gone, ctx->bss_cb_arg);
+
+		it = table->entries.erase(it);
+	}
+}
+
+// Counts a BSS of the dump in flight as added or moved if it is
+static void count_churn(struct scan_ctx* ctx, struct scan_target* target, const struct bss_record* bss) {
+
+	struct churn_table* table = target->churn_table;
+	int signal = 0;
+
+	if (bss->has_signal_mbm)
+		signal = bss->signal_mbm;
+	else if (bss->has_signal_unspec)
+		signal = bss->signal_unspec * 100;
+
+	target->churn.bsses++;
+
+	auto inserted = table->entries.emplace(mac_to_key(bss->bssid), churn_entry());
+	struct churn_entry* entry = &inserted.first->second;
+
+	if (inserted.second)
+		target->churn.added++;
+	else if (abs(signal - entry->signal) >= ctx->churn_signal_mbm)
+		target->churn.moved++;
+
+	entry->signal = signal;
+	entry->seen = table->dump;
+}
+
+// Counts and forgets the BSSes that were not in the last dump
+static void count_churn_removed(struct scan_target* target) {
+
+	struct churn_table* table = target->churn_table;
+
+	for (auto it = table->entries.begin(); it != table->entries.end(); ) {
+		if (it->second.seen == table->dump) {
+			++it;
+			continue;
+		}
+		target->churn.removed++;
+		it = table->entries.erase(it);
+	}
+
+	target->churn.valid = table->dump > 1;
+}
+
+// Same as decode_bss_ies(), but the decoded elements are taken from the cache if
+// the IE bytes of the BSS are the same as in a previous dump
+static void decode_bss_ies_cached(struct ie_cache* cache, struct bss_record* bss, unsigned int kinds) {
+
+	struct ie_cache_entry* entry = &cache->entries[mac_to_key(bss->bssid)];
+
+	entry->seen = cache->dump;
+
+	if (entry->ie_hash != bss->ie_hash) {
+		decode_bss_ies(bss, kinds);
+		entry->ie_hash = bss->ie_hash;
+		entry->elements = bss->elements;
+		entry->beacon_differs = bss->beacon_differs;
+		if (bss->beacon_differs)
+			entry->beacon = bss->beacon;
+		return;
+	}
+
+	bss->elements = entry->elements;
+	bss->beacon_differs = entry->beacon_differs;
+	if (entry->beacon_differs)
+		bss->beacon = entry->beacon;
+}
+
+// Forgets the cached information elements of BSSes that were not in the last dump
+static void expire_ie_cache(struct ie_cache* cache) {
+	for (auto it = cache->entries.begin(); it != cache->entries.end(); ) {
+		if (it->second.seen != cache->dump)
+			it = cache->entries.erase(it);
+		else
+			++it;
+	}
+}
+
+// Adds a BSS of the dump in flight to the next shared memory table. Only the SSID
+// is taken from the elements, without decoding them.
+static void shm_stage(struct scan_ctx* ctx, const struct scan_target* target, const struct bss_record* bss) {
+	struct apscan_shm_bss entry;
+
+	memset(&entry, 0, sizeof(entry));
+	memcpy(entry.bssid, bss->bssid, sizeof(entry.bssid));
+	entry.iface = (__u8)(target - ctx->targets);
+	if (bss->has_signal_mbm) {
+		entry.flags |= APSCAN_BSS_SIGNAL_MBM;
+		entry.signal_mbm = bss->signal_mbm;
+	}
+	if (bss->has_signal_unspec) {
+		entry.flags |= APSCAN_BSS_SIGNAL_UNSPEC;
+		entry.signal_unspec = bss->signal_unspec;
+	}
+	if (bss->has_capability) {
+		entry.flags |= APSCAN_BSS_CAPABILITY;
+		entry.capability = bss->capability;
+	}
+	entry.freq = bss->freq;
+	entry.ie_hash = bss->ie_hash;
+
+	const __u8* ie = bss->ies;
+	int len = bss->ies_len;
+	while (len >= 2 && ie[1] + 2 <= len) {
+		if (ie[0] == 0) {
+			if (ie[1] <= sizeof(entry.ssid)) {
+				entry.flags |= APSCAN_BSS_SSID;
+				entry.ssid_len = ie[1];
+				memcpy(entry.ssid, ie + 2, ie[1]);
+			}
+			break;
+		}
+		len -= ie[1] + 2;
+		ie += ie[1] + 2;
+	}
+
+	ctx->shm->staged[target - ctx->targets].push_back(entry);
+}
+
+// Makes the last dump of a target part of the shared memory table. The table that
+// readers are not directed to is filled, then the generation moves them over.
+static void shm_publish(struct scan_ctx* ctx, const struct scan_target* target) {
+	struct scan_shm* shm = ctx->shm;
+	struct apscan_shm_header* hdr = shm->hdr;
+	__u64 generation = hdr->generation + 1;
+	struct apscan_shm_table* table = (struct apscan_shm_table*)((char*)hdr + hdr->table_offset[generation & 1]);
+	struct apscan_shm_bss* entries = (struct apscan_shm_bss*)(table + 1);
+
+	shm->published[target - ctx->targets].swap(shm->staged[target - ctx->targets]);
+	shm->staged[target - ctx->targets].clear();
+
+	// a reader that is still on this table, two generations behind, starts over
+	__atomic_store_n(&table->seq, table->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__u32 count = 0;
+	__u32 total = 0;
+	memset(table->ifnames, 0, sizeof(table->ifnames));
+	for (int i = 0; i < ctx->ntargets; i++) {
+		const std::vector<struct apscan_shm_bss>& bsses = shm->published[i];
+		size_t n = std::min(bsses.size(), (size_t)(hdr->capacity - count));
+
+		memcpy(table->ifnames[i], ctx->targets[i].ifname, strlen(ctx->targets[i].ifname));
+		memcpy(entries + count, bsses.data(), n * sizeof(*entries));
+		count += n;
+		total += bsses.size();
+	}
+	table->count = count;
+	table->total = total;
+	table->generation = generation;
+	table->time_ns = realtime_ns();
+
+	__atomic_store_n(&table->seq, table->seq + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->generation, generation, __ATOMIC_RELEASE);
+}
+
+// Counts a BSS that was handled and the time it took since start_ns
+static void stats_bss(struct scan_ctx* ctx, long long start_ns) {
+	if (ctx->stats == NULL)
+		return;
+	ctx->stats->bss++;
+	stats_add(ctx, PHASE_BSS, monotonic_ns() - start_ns);
+}
+
+static unsigned int freq_band(__u32 freq) {
+	if (freq >= 2400 && freq < 2500)
+		return SCAN_BAND_2GHZ;
+	if (freq >= 4900 && freq < 5925)
+		return SCAN_BAND_5GHZ;
+	if (freq >= 5925 && freq <= 7125)
+		return SCAN_BAND_6GHZ;
+	if (freq >= 57000 && freq <= 71000)
+		return SCAN_BAND_60GHZ;
+	return 0;
+}
+
+// True if a BSS passes the filter. It only looks at the parsed attributes and at
+// single elements of the raw ones, the cheapest criteria come first.
+static bool filter_bss(const struct scan_filter* filter, const struct bss_record* bss) {
+
+	if (filter->min_signal_mbm != 0 && bss->has_signal_mbm && bss->signal_mbm < filter->min_signal_mbm)
+		return false;
+
+	if (filter->bands != 0 && !(freq_band(bss->freq) & filter->bands))
+		return false;
+
+	if (filter->nssid_globs > 0) {
+		char ssid[33] = "";
+		const __u8* ie = find_ie(bss->ies, bss->ies_len, 0);
+		int i;
+
+		if (ie && ie[1] < sizeof(ssid)) {
+			memcpy(ssid, ie + 2, ie[1]);
+			ssid[ie[1]] = '\0';
+		}
+		for (i = 0; i < filter->nssid_globs; i++) {
+			if (fnmatch(filter->ssid_globs[i], ssid, 0) == 0)
+				break;
+		}
+		if (i == filter->nssid_globs)
+			return false;
+	}
+
+	if (filter->security != 0 && !(bss_security(bss) & filter->security))
+		return false;
+
+	return true;
+}
+
+// A BSS on a channel that was just scanned is gone if it was last received this
+// long before the scan started. The kernel counts the age in jiffies, and a BSS
+// received right before the scan is likely still there.
+const long SPLIT_GONE_MS = 1000;
+
+static bool has_channel(const std::vector<__u32>& channels, __u32 freq) {
+	return std::find(channels.begin(), channels.end(), freq) != channels.end();
+}
+
+// Keeps a BSS of the dump in flight in the rolling table. Returns false if the BSS
+// is gone: the scan of its channel did not see it, the kernel only still has it.
+static bool split_track(struct scan_target* target, struct nlmsghdr* hdr, const struct bss_record* bss) {
+
+	struct split_scan* split = target->split;
+
+	// BSSes on channels that are never scanned come and go with the kernel's cache
+	if (split->replaying || !has_channel(split->channels, bss->freq))
+		return true;
+
+	long long seen_ms = monotonic_ns() / 1000000 - (bss->has_seen_ms_ago ? bss->seen_ms_ago : 0);
+	__u64 key = mac_to_key(bss->bssid);
+
+	if (split->covered && seen_ms < split->group_start_ms - SPLIT_GONE_MS && has_channel(split->group, bss->freq)) {
+		split->entries.erase(key);
+		return false;
+	}
+
+	struct rolling_entry* entry = &split->entries[key];
+	entry->msg.assign((const __u8*)hdr, (const __u8*)hdr + hdr->nlmsg_len);
+	entry->freq = bss->freq;
+	entry->seen_ms = seen_ms;
+	entry->dump = split->dump;
+	return true;
+}
+
+// Notes when a BSS in the cache was last seen. Without the age the BSS cannot
+// count as fresh.
+static void probe_bss(struct scan_ctx* ctx, struct scan_target* target, const struct bss_record* bss) {
+
+	if (!bss->has_seen_ms_ago)
+		return;
+
+	long long seen_ms = monotonic_ns() / 1000000 - bss->seen_ms_ago;
+	if (seen_ms > target->probe_newest_ms)
+		target->probe_newest_ms = seen_ms;
+
+	for (int i = 0; i < ctx->params.nfreqs; i++) {
+		if (ctx->params.freqs[i] == bss->freq && seen_ms > target->probe_freq_newest_ms[i])
+			target->probe_freq_newest_ms[i] = seen_ms;
+	}
+}
+
+// Called with each BSS of the dump of a target. The message is decoded where it
+// was received, the record on the stack points into it.
+static void receive_scan_result(struct scan_ctx* ctx, struct scan_target* target, struct nlmsghdr* hdr) {
+
+	struct bss_record bss;
+	long long start_ns = ctx->stats ? monotonic_ns() : 0;
+
+	int err = parse_scan_result(hdr, &bss);
+	if (err == -NLE_MISSING_ATTR) {
+		return;
+	} else if (err < 0) {
+		scan_log(ctx, target, SCAN_LOG_ERROR, "error parsing scan result: %d, %s", err, nl_geterror(err));
+		return;
+	}
+
+	if (target->probing) {
+		probe_bss(ctx, target, &bss);
+		return;
+	}
+
+	if (target->fresh_since_ms != 0 &&
+		(!bss.has_seen_ms_ago || monotonic_ns() / 1000000 - bss.seen_ms_ago < target->fresh_since_ms))
+		return;
+
+	if (!filter_bss(&ctx->filter, &bss)) {
+		stats_bss(ctx, start_ns);
+		return;
+	}
+
+	if (target->dump_log) {
+		struct dump_log* log = target->dump_log;
+		__u64 key = mac_to_key(bss.bssid);
+
+		// delivered before the dump was restarted
+		if (std::binary_search(log->keys.begin(), log->keys.begin() + log->sorted, key))
+			return;
+		log->keys.push_back(key);
+	}
+
+	// only what compares the elements needs their hash
+	if (target->table || target->ie_cache || ctx->shm)
+		bss.ie_hash = hash_bss_ies(&bss);
+
+	if (target->split && !split_track(target, hdr, &bss)) {
+		stats_bss(ctx, start_ns);
+		return;
+	}
+
+	target->dump_bss++;
+
+	if (target->churn_table)
+		count_churn(ctx, target, &bss);
+
+	// every BSS, in diff mode too
+	if (ctx->shm)
+		shm_stage(ctx, target, &bss);
+
+	bss.ifname = target->ifname;
+	bss.changes = BSS_ALL;
+
+	if (target->table) {
+		bss.changes = diff_bss(target->table, &bss);
+		if (bss.changes == 0) {
+			stats_bss(ctx, start_ns);
+			return;
+		}
+	}
+
+	// the elements are only needed when they are reported
+	unsigned int kinds = DECODE_ALL & ~ctx->skip_ies;
+	if (bss.changes & BSS_IES) {
+		if (kinds == 0)
+			memset(&bss.elements, 0, sizeof(bss.elements));
+		else if (target->ie_cache)
+			decode_bss_ies_cached(target->ie_cache, &bss, kinds);
+		else
+			decode_bss_ies(&bss, kinds);
+	}
+
+	stats_bss(ctx, start_ns);
+
+	if (ctx->bss_cb)
+		ctx->bss_cb(&bss, ctx->bss_cb_arg);
+}
+
+// Reports the BSSes of the rolling table that the dump did not deliver, with their
+// age updated, and forgets those that the scan of their channel did not see
+static void split_report_rest(struct scan_ctx* ctx, struct scan_target* target) {
+
+	struct split_scan* split = target->split;
+	long long now_ms = monotonic_ns() / 1000000;
+
+	split->replaying = true;
+
+	for (auto it = split->entries.begin(); it != split->entries.end(); ) {
+		struct rolling_entry* entry = &it->second;
+
+		if (entry->dump == split->dump) {
+			++it;
+			continue;
+		}
+
+		if (split->covered && has_channel(split->group, entry->freq)) {
+			it = split->entries.erase(it);
+			continue;
+		}
+
+		struct nlmsghdr* hdr = (struct nlmsghdr*)entry->msg.data();
+		struct nlattr* bss = nlmsg_find_attr(hdr, GENL_HDRLEN, NL80211_ATTR_BSS);
+		struct nlattr* age = bss ? nla_find((struct nlattr*)nla_data(bss), nla_len(bss), NL80211_BSS_SEEN_MS_AGO) : NULL;
+		if (age != NULL)
+			*(__u32*)nla_data(age) = (__u32)(now_ms - entry->seen_ms);
+
+		receive_scan_result(ctx, target, hdr);
+		++it;
+	}
+
+	split->replaying = false;
+}
+
+// Messages that are not errors, acks or NLMSG_DONE. Parts of the GET_SCAN dump in
+// flight are scan results, other messages are events from the scan multicast group.
+static void valid_handler(struct scan_ctx* ctx, struct nlmsghdr* hdr) {
+
+	if (hdr->nlmsg_flags & NLM_F_MULTI) {
+		struct scan_target* target = target_by_seq(ctx, hdr->nlmsg_seq);
+
+		// left over from a dump that timed out
+		if (!target || target->state != TARGET_DUMPING)
+			return;
+
+		// the BSS list changed while it was dumped, some BSSes may be missing
+		if (ctx->stats)
+			stats_dump_message(ctx, target);
+		if (hdr->nlmsg_flags & NLM_F_DUMP_INTR)
+			dump_interrupted(ctx, target);
+		receive_scan_result(ctx, target, hdr);
+		return;
+	}
+
+	scan_finished_cb(ctx, hdr);
+}
+
+// Appends a record to the recording. A write error ends the recording, the scan
+// goes on without it.
+static void record_write(struct scan_ctx* ctx, int type, const void* data, size_t len) {
+	static const char padding[8] = { 0 };
+	struct scan_recording* rec = ctx->recording;
+	struct record_header hdr;
+
+	if (rec == NULL)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.time_ns = monotonic_ns() - rec->start_ns;
+	hdr.len = len;
+	hdr.type = type;
+
+	size_t pad = (8 - len % 8) % 8;
+	if (fwrite(&hdr, sizeof(hdr), 1, rec->file) != 1 ||
+		(len && fwrite(data, len, 1, rec->file) != 1) ||
+		(pad && fwrite(padding, pad, 1, rec->file) != 1)) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error writing the recording: %d, %s", errno, strerror(errno));
+		fclose(rec->file);
+		delete rec;
+		ctx->recording = NULL;
+	}
+}
+
+static void record_target(struct scan_ctx* ctx, const struct scan_target* target) {
+	char data[sizeof(__u32) + IF_NAMESIZE];
+	__u32 if_index = target->if_index;
+
+	memset(data, 0, sizeof(data));
+	memcpy(data, &if_index, sizeof(if_index));
+	memcpy(data + sizeof(if_index), target->ifname, strlen(target->ifname));
+	record_write(ctx, RECORD_TARGET, data, sizeof(data));
+}
+
+// Passes a received message to its handler, the way nl_recvmsgs() would with the
+// callbacks set, but without copying every message into an nl_msg first. There is
+// no sequence number check, the handlers match replies against the targets'
+// req_seq themselves and events come with another one.
+static void dispatch_message(struct scan_ctx* ctx, struct nlmsghdr* hdr) {
+
+	// a replay would report a probe of the cache as a dump
+	if (!(ctx->dumping && ctx->dumping->probing && hdr->nlmsg_seq == ctx->dumping->req_seq))
+		record_write(ctx, RECORD_MSG_IN, hdr, hdr->nlmsg_len);
+
+	switch (hdr->nlmsg_type) {
+	case NLMSG_NOOP:
+	case NLMSG_OVERRUN:
+		break;
+	case NLMSG_DONE:
+		finish_handler(ctx, hdr);
+		break;
+	case NLMSG_ERROR: {
+		struct nlmsgerr* err = (struct nlmsgerr*)nlmsg_data(hdr);
+
+		if (hdr->nlmsg_len < (__u32)nlmsg_size(sizeof(*err)))
+			break;
+		if (err->error)
+			error_handler(ctx, err);
+		else
+			ack_handler(ctx, hdr);
+		break;
+	}
+	default:
+		valid_handler(ctx, hdr);
+		break;
+	}
+}
+
+// Enlarges the receive buffer to hold a datagram of size bytes
+static int grow_recv_buf(struct scan_ctx* ctx, size_t size) {
+
+	// whole pages, the kernel sizes its datagrams in pages as well
+	size = (size + 4095) & ~(size_t)4095;
+
+	void* buf = realloc(ctx->recv_buf, size);
+	if (buf == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating a %zu byte receive buffer", size);
+		return -ENOMEM;
+	}
+
+	ctx->recv_buf = buf;
+	ctx->recv_buf_size = size;
+	ctx->counters.buffer_grown++;
+	scan_log(ctx, NULL, SCAN_LOG_INFO, "receive buffer enlarged to %zu bytes", size);
+	return 0;
+}
+
+// Handles a failed recvmsg(). Returns 0 if receiving can go on, 1 if the state of
+// the targets changed and has to be looked at before waiting again.
+static int receive_error(struct scan_ctx* ctx, int err) {
+
+	if (err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+		return 0;
+
+	if (err != ENOBUFS)
+		return -err;
+
+	// The socket receive queue was full and the kernel dropped messages. Dumps
+	// wait for room in the queue and lose nothing, but a scan event may be gone.
+	// Every target still waiting for one is dumped now, in every mode: without
+	// a scan timeout an active scan would wait forever. If its scan is in fact
+	// still running, the dump reports what the kernel has so far and the late
+	// event is ignored.
+	ctx->counters.enobufs++;
+	scan_log(ctx, NULL, SCAN_LOG_ERROR, "netlink receive queue overflowed, events were lost");
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (ctx->targets[i].state == TARGET_SCANNING)
+			ctx->targets[i].state = TARGET_SCANNED;
+	}
+	return 1;
+}
+
+// Receives one datagram from the non-blocking socket into the receive buffer and
+// dispatches the messages in it. With recv_peek the size of the datagram is looked
+// at first and the buffer grows to fit it. Otherwise a datagram that does not fit
+// is cut off, which interrupts the dump in flight, and the buffer grows for the
+// next one. Returns the number of bytes received, 0 if there was nothing to
+// receive, 1 after an overflow of the receive queue, or a negative error code.
+static int receive_messages(struct scan_ctx* ctx) {
+
+	int fd = nl_socket_get_fd(ctx->socket);
+	struct sockaddr_nl nla;
+	struct iovec iov = { ctx->recv_buf, 0 };
+	struct msghdr mhdr;
+	ssize_t n;
+
+	memset(&mhdr, 0, sizeof(mhdr));
+	mhdr.msg_name = &nla;
+	mhdr.msg_namelen = sizeof(nla);
+	mhdr.msg_iov = &iov;
+	mhdr.msg_iovlen = 1;
+
+	// with MSG_TRUNC, recvmsg() returns the real size of the datagram
+	if (ctx->buffers.recv_peek) {
+		n = recvmsg(fd, &mhdr, MSG_PEEK | MSG_TRUNC);
+		if (n < 0)
+			return receive_error(ctx, errno);
+		if ((size_t)n > ctx->recv_buf_size && grow_recv_buf(ctx, n) != 0)
+			return -ENOMEM;
+	}
+
+	iov.iov_base = ctx->recv_buf;
+	iov.iov_len = ctx->recv_buf_size;
+	mhdr.msg_namelen = sizeof(nla);
+
+	n = recvmsg(fd, &mhdr, MSG_TRUNC);
+	if (n < 0)
+		return receive_error(ctx, errno);
+
+	size_t size = (size_t)n;
+	if (ctx->stats)
+		ctx->stats->bytes += size;
+	if (size > ctx->recv_buf_size) {
+		ctx->counters.truncated++;
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "a %zu byte datagram did not fit into the %zu byte receive buffer",
+			size, ctx->recv_buf_size);
+		if (ctx->dumping)
+			dump_interrupted(ctx, ctx->dumping);
+	}
+
+	struct nlmsghdr* hdr = (struct nlmsghdr*)ctx->recv_buf;
+	int len = (int)std::min(size, ctx->recv_buf_size);
+
+	while (nlmsg_ok(hdr, len)) {
+		dispatch_message(ctx, hdr);
+		hdr = nlmsg_next(hdr, &len);
+	}
+
+	if (size > ctx->recv_buf_size && grow_recv_buf(ctx, size) != 0)
+		return -ENOMEM;
+
+	return (int)n;
+}
+
+// Sends a request of a target and makes it the target's request in flight.
+// nl_send_auto() only assigns a sequence number to a message if it still carries
+// NL_AUTO_SEQ, so a reused message has to be rearmed before every send.
+static int send_request(struct scan_ctx* ctx, struct scan_target* target, struct nl_msg* msg) {
+	nlmsg_hdr(msg)->nlmsg_seq = NL_AUTO_SEQ;
+
+	int ret = nl_send_auto(ctx->socket, msg);
+	target->req_seq = nlmsg_hdr(msg)->nlmsg_seq;
+	target->req_status = ret < 0 ? ret : 1;
+	if (ctx->stats)
+		target->request_ns = monotonic_ns();
+
+	if (ret >= 0 && !target->probing)
+		record_write(ctx, RECORD_MSG_OUT, nlmsg_hdr(msg), nlmsg_hdr(msg)->nlmsg_len);
+	return ret;
+}
+
+static long long monotonic_ms() {
+	return monotonic_ns() / 1000000;
+}
+
+// Receives and dispatches messages until pending() returns false. The socket is
+// non-blocking, poll() sleeps until more data arrives or the timeout expires. The
+// poll_fd of the context is served in between.
+// Returns 0 when done, -ETIMEDOUT after timeout_ms (0 waits forever), -EINTR if a
+// stop was requested by a signal and -EIO if receiving failed.
+static int wait_for(struct scan_ctx* ctx, bool (*pending)(const struct scan_ctx*), long timeout_ms) {
+
+	long long deadline = timeout_ms > 0 ? monotonic_ms() + timeout_ms : 0;
+	struct pollfd pfds[2];
+	int npfds = ctx->poll_cb ? 2 : 1;
+
+	pfds[0].fd = nl_socket_get_fd(ctx->socket);
+	pfds[0].events = POLLIN;
+	pfds[1].fd = ctx->poll_fd;
+	pfds[1].events = POLLIN;
+
+	while (pending(ctx)) {
+		// also when messages keep arriving, they must not hold off the timeout
+		int wait_ms = -1;
+		if (deadline) {
+			long long left = deadline - monotonic_ms();
+			if (left <= 0)
+				return -ETIMEDOUT;
+			wait_ms = (int)left;
+		}
+
+		int ret = receive_messages(ctx);
+		if (ret > 0)
+			continue;
+
+		if (ret < 0) {
+			scan_log(ctx, NULL, SCAN_LOG_ERROR, "receiving failed: %d, %s", -ret, strerror(-ret));
+			return -EIO;
+		}
+
+		if (ctx->stop)
+			return -EINTR;
+
+		ret = poll(pfds, npfds, wait_ms);
+		if (ctx->stop)
+			return -EINTR;
+		if (ret < 0 && errno != EINTR) {
+			scan_log(ctx, NULL, SCAN_LOG_ERROR, "poll failed: %d, %s", errno, strerror(errno));
+			return -EIO;
+		}
+		if (ret > 0 && npfds > 1 && (pfds[1].revents & POLLIN))
+			ctx->poll_cb(ctx->poll_cb_arg);
+	}
+
+	return 0;
+}
+
+// Adds the SSIDs to send probe requests for and the channels to scan, all channels
+// if nfreqs is 0
+static void put_scan_lists(struct nl_msg* msg, const struct scan_params* params, const __u32* freqs, int nfreqs) {
+
+	// The attribute type is just the position in the list, a zero length SSID is
+	// the wildcard SSID that scans all SSIDs.
+	struct nlattr* ssids = nla_nest_start(msg, NL80211_ATTR_SCAN_SSIDS);
+	if (params->nssids == 0) {
+		nla_put(msg, 1, 0, "");
+	}
+	for (int i = 0; i < params->nssids; i++) {
+		nla_put(msg, i + 1, strlen(params->ssids[i]), params->ssids[i]);
+	}
+	nla_nest_end(msg, ssids);
+
+	if (nfreqs > 0) {
+		struct nlattr* list = nla_nest_start(msg, NL80211_ATTR_SCAN_FREQUENCIES);
+		for (int i = 0; i < nfreqs; i++) {
+			nla_put_u32(msg, i + 1, freqs[i]);
+		}
+		nla_nest_end(msg, list);
+	}
+}
+
+// Builds a NL80211_CMD_TRIGGER_SCAN request of a target for the channels in freqs,
+// all channels if nfreqs is 0. Returns NULL if it could not be allocated.
+static struct nl_msg* trigger_msg_alloc(struct scan_ctx* ctx, struct scan_target* target, const __u32* freqs,
+	int nfreqs) {
+
+	const struct scan_params* params = &ctx->params;
+	struct nl_msg* msg = nlmsg_alloc();
+
+	if (msg == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating netlink message");
+		return NULL;
+	}
+
+	// Construct message header
+	// I think this function returns something relevant only if the user_header parameter
+	// is specified as non-zero? I have no idea.
+	genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, ctx->family_id, 0, 0, NL80211_CMD_TRIGGER_SCAN, 0);
+
+	// Add message attribute specifying which interface to use.
+	nla_put_u32(msg, NL80211_ATTR_IFINDEX, target->if_index);
+
+	put_scan_lists(msg, params, freqs, nfreqs);
+
+	if (params->duration_tu > 0 && target->dwell_supported) {
+		nla_put_u16(msg, NL80211_ATTR_MEASUREMENT_DURATION, params->duration_tu);
+	}
+
+	if (target->scan_flags != 0) {
+		nla_put_u32(msg, NL80211_ATTR_SCAN_FLAGS, target->scan_flags);
+	}
+
+	return msg;
+}
+
+// Builds the NL80211_CMD_START_SCHED_SCAN request of a target. It scans the same
+// SSIDs and channels as a triggered scan and adds the interval and the match sets.
+static int scan_target_init_sched(struct scan_ctx* ctx, struct scan_target* target) {
+
+	const struct scan_params* params = &ctx->params;
+	struct nl_msg* msg = nlmsg_alloc();
+
+	if (msg == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating netlink message");
+		return 1;
+	}
+	target->sched_msg = msg;
+
+	genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, ctx->family_id, 0, 0, NL80211_CMD_START_SCHED_SCAN, 0);
+	nla_put_u32(msg, NL80211_ATTR_IFINDEX, target->if_index);
+	put_scan_lists(msg, params, params->freqs, params->nfreqs);
+	nla_put_u32(msg, NL80211_ATTR_SCHED_SCAN_INTERVAL, params->sched_interval_ms);
+
+	// Every match set is a nested attribute numbered from 1. Without SSIDs a single
+	// set with only the signal threshold applies to every BSS.
+	int nsets = params->nmatch_ssids > 0 ? params->nmatch_ssids : (params->match_rssi != 0 ? 1 : 0);
+	if (nsets > 0) {
+		struct nlattr* matches = nla_nest_start(msg, NL80211_ATTR_SCHED_SCAN_MATCH);
+
+		for (int i = 0; i < nsets; i++) {
+			struct nlattr* set = nla_nest_start(msg, i + 1);
+
+			if (i < params->nmatch_ssids) {
+				nla_put(msg, NL80211_SCHED_SCAN_MATCH_ATTR_SSID, strlen(params->match_ssids[i]),
+					params->match_ssids[i]);
+			}
+			if (params->match_rssi != 0) {
+				nla_put_u32(msg, NL80211_SCHED_SCAN_MATCH_ATTR_RSSI, (__u32)params->match_rssi);
+			}
+			nla_nest_end(msg, set);
+		}
+		nla_nest_end(msg, matches);
+	}
+
+	if (target->scan_flags != 0) {
+		nla_put_u32(msg, NL80211_ATTR_SCAN_FLAGS, target->scan_flags);
+	}
+
+	// the kernel stops the scheduled scan when the socket is closed, even if the
+	// program dies without stopping it
+	nla_put_flag(msg, NL80211_ATTR_SOCKET_OWNER);
+
+	return 0;
+}
+
+// Builds the requests of a target, called once per interface.
+static int scan_target_init(struct scan_ctx* ctx, struct scan_target* target) {
+
+	target->trigger_msg = trigger_msg_alloc(ctx, target, ctx->params.freqs, ctx->params.nfreqs);
+	if (target->trigger_msg == NULL) {
+		return 1;
+	}
+
+	if (ctx->sched && scan_target_init_sched(ctx, target) != 0) {
+		return 1;
+	}
+
+	// Setup which command to run to get info for all SSIDs detected
+	target->dump_msg = nlmsg_alloc();
+	if (target->dump_msg == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating netlink message");
+		return 1;
+	}
+	genlmsg_put(target->dump_msg, 0, 0, ctx->family_id, 0, NLM_F_DUMP, NL80211_CMD_GET_SCAN, 0);
+
+	// Add message attribute specifying which interface to use
+	nla_put_u32(target->dump_msg, NL80211_ATTR_IFINDEX, target->if_index);
+
+	return 0;
+}
+
+// Adds an interface by name to the targets of the scan context.
+int scan_ctx_add_target(struct scan_ctx* ctx, const char* ifname) {
+
+	if (ctx->ntargets >= MAX_SCAN_TARGETS) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "too many interfaces, ignoring %s", ifname);
+		return 1;
+	}
+
+	struct scan_target* target = &ctx->targets[ctx->ntargets];
+
+	target->if_index = if_nametoindex(ifname);
+	if (target->if_index == 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error matching interface %s into a real interface: %d, %s",
+			ifname, errno, strerror(errno));
+		return 1;
+	}
+
+	target->wiphy = -1;
+	snprintf(target->ifname, sizeof(target->ifname), "%s", ifname);
+	ctx->ntargets++;
+
+	return 0;
+}
+
+// Allocates the netlink socket of the scan context, connects it to generic netlink
+// and resolves the nl80211 family. The socket is freed by scan_ctx_free().
+int scan_ctx_connect(struct scan_ctx* ctx) {
+
+	// Allocate a netlink socket
+	ctx->socket = nl_socket_alloc();
+	if (ctx->socket == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating nl socket");
+		return 1;
+	}
+
+	// Connect the allocated socket to libnl
+	int err = genl_connect(ctx->socket);
+	if (err < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Error connecting nl socket: %d, %s", err, nl_geterror(err));
+		return 1;
+	}
+
+	// Match the nl80211 netlink family name to its identifier
+	ctx->family_id = genl_ctrl_resolve(ctx->socket, "nl80211");
+	if (ctx->family_id < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error finding identifier for nl80211 family name: %d, %s",
+			ctx->family_id, nl_geterror(ctx->family_id));
+		return 1;
+	}
+
+	return 0;
+}
+
+// Allocates the diff table and the IE cache of a target if they are enabled
+static void target_tables_init(struct scan_ctx* ctx, struct scan_target* target) {
+
+	if (ctx->diff_hysteresis >= 0) {
+		target->table = new bss_table();
+		target->table->dump = 0;
+		target->table->hysteresis = ctx->diff_hysteresis;
+	}
+
+	if (ctx->churn_signal_mbm > 0) {
+		target->churn_table = new churn_table();
+		target->churn_table->dump = 0;
+	}
+
+	if (ctx->use_ie_cache) {
+		target->ie_cache = new ie_cache();
+		target->ie_cache->dump = 0;
+	}
+
+	if (ctx->buffers.max_dump_restarts > 0) {
+		target->dump_log = new dump_log();
+		target->dump_log->sorted = 0;
+	}
+	if (ctx->shm)
+		ctx->shm->staged[target - ctx->targets].clear();
+	target->first_msg_ns = 0;
+}
+
+// Sets the size of the socket receive queue. SO_RCVBUFFORCE can go beyond
+// net.core.rmem_max but needs CAP_NET_ADMIN, SO_RCVBUF is the fallback.
+static int set_socket_buffer(struct scan_ctx* ctx, int size) {
+
+	int fd = nl_socket_get_fd(ctx->socket);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0 &&
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error setting the socket receive buffer: %d, %s", errno, strerror(errno));
+		return 1;
+	}
+
+	// the kernel doubles the size for its bookkeeping, less than asked for means
+	// that rmem_max cut it
+	int actual = 0;
+	socklen_t len = sizeof(actual);
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &actual, &len) == 0 && actual < size)
+		scan_log(ctx, NULL, SCAN_LOG_INFO, "socket receive buffer limited to %d bytes by net.core.rmem_max", actual / 2);
+
+	return 0;
+}
+
+// Builds the receive buffer and the requests of all targets kept in the scan context.
+int scan_ctx_init(struct scan_ctx* ctx) {
+
+	ctx->mcid = genl_ctrl_resolve_grp(ctx->socket, "nl80211", "scan");
+	if (ctx->mcid < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error resolving netlink group name to identifier: %d, %s",
+			ctx->mcid, nl_geterror(ctx->mcid));
+		return 1;
+	}
+
+	// allocated once, every message is handled in place in this buffer
+	size_t recv_size = ctx->buffers.recv_size > 0 ? (size_t)ctx->buffers.recv_size : RECV_BUF_SIZE;
+	ctx->recv_buf = malloc(recv_size);
+	if (ctx->recv_buf == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating the receive buffer");
+		return 1;
+	}
+	ctx->recv_buf_size = recv_size;
+
+	if (ctx->buffers.socket_size > 0 && set_socket_buffer(ctx, ctx->buffers.socket_size) != 0) {
+		return 1;
+	}
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (scan_target_init(ctx, &ctx->targets[i]) != 0) {
+			return 1;
+		}
+
+		target_tables_init(ctx, &ctx->targets[i]);
+		record_target(ctx, &ctx->targets[i]);
+	}
+
+	// From here on all waiting is done in wait_for()
+	int ret = nl_socket_set_nonblocking(ctx->socket);
+	if (ret < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed setting socket non-blocking: %d, %s", ret, nl_geterror(ret));
+		return 1;
+	}
+
+	return 0;
+}
+
+void scan_ctx_free(struct scan_ctx* ctx) {
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		if (target->trigger_msg != NULL) {
+			nlmsg_free(target->trigger_msg);
+			target->trigger_msg = NULL;
+		}
+
+		if (target->dump_msg != NULL) {
+			nlmsg_free(target->dump_msg);
+			target->dump_msg = NULL;
+		}
+
+		if (target->sched_msg != NULL) {
+			nlmsg_free(target->sched_msg);
+			target->sched_msg = NULL;
+		}
+
+		delete target->table;
+		target->table = NULL;
+
+		delete target->churn_table;
+		target->churn_table = NULL;
+
+		delete target->split;
+		target->split = NULL;
+
+		delete target->ie_cache;
+		target->ie_cache = NULL;
+
+		delete target->dump_log;
+		target->dump_log = NULL;
+	}
+
+	free(ctx->recv_buf);
+	ctx->recv_buf = NULL;
+	ctx->recv_buf_size = 0;
+
+	if (ctx->socket != NULL) {
+		nl_socket_free(ctx->socket);
+		ctx->socket = NULL;
+	}
+
+	if (ctx->recording != NULL) {
+		fclose(ctx->recording->file);
+		delete ctx->recording;
+		ctx->recording = NULL;
+	}
+
+	// the last table stays readable, readers learn that no newer one will come
+	if (ctx->shm != NULL) {
+		__atomic_store_n(&ctx->shm->hdr->closed, 1, __ATOMIC_RELEASE);
+		munmap(ctx->shm->hdr, ctx->shm->size);
+		delete ctx->shm;
+		ctx->shm = NULL;
+	}
+}
+
+static void target_failed(struct scan_target* target, int err) {
+	target->state = TARGET_FAILED;
+	target->err = err;
+}
+
+// Sends NL80211_CMD_TRIGGER_SCAN (or NL80211_CMD_START_SCHED_SCAN) to all idle
+// targets at once and waits until the kernel has acknowledged or rejected every
+// one of them. The caller must have joined the scan multicast group, as the
+// completion events can arrive right after the ack.
+static int do_scan_trigger(struct scan_ctx* ctx, bool sched) {
+
+	int err;
+	int sent = 0;
+
+	// Send NL80211_CMD_TRIGGER_SCAN to start the scans.
+	// The kernel may reply with NL80211_CMD_NEW_SCAN_RESULTS on success or
+	// NL80211_CMD_SCAN_ABORTED if another scan was started by another process.
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		if (target->state != TARGET_IDLE)
+			continue;
+
+		target->state = TARGET_TRIGGERED;
+		target->err = 0;
+		target->aborted = false;
+
+		struct nl_msg* msg = target->partial_msg ? target->partial_msg : target->trigger_msg;
+		int written = send_request(ctx, target, sched ? target->sched_msg : msg);
+		if (written < 0) {
+			scan_log(ctx, target, SCAN_LOG_ERROR, "error in nl_send_auto: %d, %s", written, nl_geterror(written));
+			target_failed(target, 1);
+			continue;
+		}
+
+		scan_log(ctx, target, SCAN_LOG_INFO, "nl_send_auto wrote %d bytes", written);
+		sent++;
+		if (ctx->stats && !sched) {
+			ctx->stats->triggers++;
+			target->cycle_ns = target->request_ns;
+		}
+	}
+
+	// e.g. every target reported its cache instead
+	if (sent == 0)
+		return 0;
+
+	if (!sched)
+		scan_log(ctx, NULL, SCAN_LOG_INFO, "Waiting for scan to complete");
+
+	// wait for ack_handler|error_handler of every target
+	err = wait_for(ctx, [](const struct scan_ctx* c) {
+			for (int i = 0; i < c->ntargets; i++) {
+				if (c->targets[i].state == TARGET_TRIGGERED)
+					return true;
+			}
+			return false;
+		}, ctx->timeouts.ack_ms);
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		if (target->state == TARGET_TRIGGERED) {
+			if (err == -ETIMEDOUT)
+				scan_log(ctx, target, SCAN_LOG_ERROR, "timed out waiting for the scan request to be acknowledged");
+			target_failed(target, err);
+		} else if (target->state == TARGET_FAILED && target->err < 0) {
+			// with retries, busy is reported once they are used up
+			int level = target->err == -EBUSY && ctx->retry.deadline_ms > 0 ? SCAN_LOG_INFO : SCAN_LOG_ERROR;
+			scan_log(ctx, target, level, "error flag set during message transmission: %d, %s",
+				target->err, strerror(-target->err));
+		}
+	}
+
+	return err;
+}
+
+static void dump_begin(struct scan_ctx* ctx, struct scan_target* target) {
+	if (target->table)
+		target->table->dump++;
+	if (target->ie_cache)
+		target->ie_cache->dump++;
+	if (target->churn_table)
+		target->churn_table->dump++;
+	memset(&target->churn, 0, sizeof(target->churn));
+	if (target->split)
+		target->split->dump++;
+
+	target->dump_intr = false;
+	target->dump_restarts = 0;
+	target->dump_bss = 0;
+	if (target->dump_log) {
+		target->dump_log->keys.clear();
+		target->dump_log->sorted = 0;
+	}
+}
+
+// Called when an interrupted dump is done. Returns true if it is to be started
+// again: the restart only delivers the BSSes the interrupted dump did not, and
+// counts as the same dump for the diff table and the IE cache.
+static bool dump_restart(struct scan_ctx* ctx, struct scan_target* target) {
+
+	if (!target->dump_intr)
+		return false;
+
+	if (target->dump_log == NULL || target->dump_restarts >= ctx->buffers.max_dump_restarts) {
+		scan_log(ctx, target, SCAN_LOG_ERROR, "scan dump was interrupted, the results may be incomplete");
+		return false;
+	}
+
+	struct dump_log* log = target->dump_log;
+	std::sort(log->keys.begin(), log->keys.end());
+	log->sorted = log->keys.size();
+
+	target->dump_intr = false;
+	target->dump_restarts++;
+	ctx->counters.dump_restarts++;
+	scan_log(ctx, target, SCAN_LOG_INFO, "scan dump was interrupted, restarting it (%d of %d)",
+		target->dump_restarts, ctx->buffers.max_dump_restarts);
+	return true;
+}
+
+// Called after a complete dump of a target
+static void dump_end(struct scan_ctx* ctx, struct scan_target* target) {
+
+	// the BSSes of the channels that were not scanned count as part of the dump
+	if (target->split) {
+		split_report_rest(ctx, target);
+		target->split->covered = false;
+	}
+
+	// only a complete dump tells which BSSes are gone
+	if (target->table)
+		report_gone_bss(ctx, target);
+	if (target->churn_table)
+		count_churn_removed(target);
+	if (target->ie_cache)
+		expire_ie_cache(target->ie_cache);
+	if (ctx->shm)
+		shm_publish(ctx, target);
+
+	if (ctx->stats) {
+		ctx->stats->dumps++;
+		if (target->first_msg_ns)
+			stats_add(ctx, PHASE_DUMP, target->last_msg_ns - target->first_msg_ns);
+		if (target->cycle_ns)
+			stats_add(ctx, PHASE_CYCLE, monotonic_ns() - target->cycle_ns);
+		target->cycle_ns = 0;
+	}
+
+	if (ctx->dump_cb)
+		ctx->dump_cb(target->ifname, ctx->dump_cb_arg);
+
+	// a recording that ends here, e.g. because the program is killed, holds
+	// complete dumps only
+	if (ctx->recording)
+		fflush(ctx->recording->file);
+}
+
+// Requests the results of the target's last scan and reports them through
+// receive_scan_result(). An interrupted dump is requested again, up to
+// max_dump_restarts times.
+static int do_scan_dump(struct scan_ctx* ctx, struct scan_target* target) {
+
+	target->state = TARGET_DUMPING;
+	dump_begin(ctx, target);
+
+	do {
+		// Send the message
+		int ret = send_request(ctx, target, target->dump_msg);
+		if (ret < 0) {
+			scan_log(ctx, target, SCAN_LOG_ERROR, "nl_send_auto() failed with: %d, %s", ret, nl_geterror(ret));
+			return 1;
+		}
+
+		// wait for the whole dump to go through, scan events of the other targets
+		// are processed in the meantime
+		ctx->dumping = target;
+		ret = wait_for(ctx, [](const struct scan_ctx* c) { return c->dumping->req_status > 0; },
+			ctx->timeouts.dump_ms);
+		ctx->dumping = NULL;
+
+		if (ret == -ETIMEDOUT) {
+			scan_log(ctx, target, SCAN_LOG_ERROR, "timed out waiting for the scan results");
+			return ret;
+		} else if (ret < 0) {
+			return ret;
+		}
+
+		if (target->req_status < 0) {
+			scan_log(ctx, target, SCAN_LOG_ERROR, "ERROR: scan dump failed with %d, %s",
+				target->req_status, strerror(-target->req_status));
+			return target->req_status;
+		}
+	} while (dump_restart(ctx, target));
+
+	// nothing was recent enough, the previous results stay in place
+	if (target->fresh_since_ms != 0 && target->dump_bss == 0)
+		return -ENODATA;
+
+	dump_end(ctx, target);
+
+	target->state = TARGET_DONE;
+	return 0;
+}
+
+// Dumps the cache of a target with probing set, nothing is reported
+static int probe_cache(struct scan_ctx* ctx, struct scan_target* target) {
+
+	target->probe_newest_ms = 0;
+	for (int i = 0; i < ctx->params.nfreqs; i++)
+		target->probe_freq_newest_ms[i] = 0;
+
+	target->state = TARGET_DUMPING;
+	target->probing = true;
+	int ret = send_request(ctx, target, target->dump_msg);
+	if (ret < 0) {
+		target->probing = false;
+		scan_log(ctx, target, SCAN_LOG_ERROR, "nl_send_auto() failed with: %d, %s", ret, nl_geterror(ret));
+		return 1;
+	}
+
+	ctx->dumping = target;
+	ret = wait_for(ctx, [](const struct scan_ctx* c) { return c->dumping->req_status > 0; },
+		ctx->timeouts.dump_ms);
+	ctx->dumping = NULL;
+	target->probing = false;
+
+	// an interrupted probe missed some BSSes at worst, which only makes the
+	// cache look older than it is
+	target->dump_intr = false;
+
+	if (ret == -ETIMEDOUT) {
+		scan_log(ctx, target, SCAN_LOG_ERROR, "timed out waiting for the cached results");
+	} else if (ret == 0 && target->req_status < 0) {
+		scan_log(ctx, target, SCAN_LOG_ERROR, "ERROR: cache dump failed with %d, %s",
+			target->req_status, strerror(-target->req_status));
+		ret = target->req_status;
+	}
+	return ret;
+}
+
+// Looks at the cache of every target before the scans of a cycle with max_age_ms.
+// A target whose cache is fresh enough reports it and is done. Otherwise it stays
+// idle to be scanned, on only the stale channels of scan_params if some are fresh.
+// Returns -EINTR or -EIO if the whole cycle has to end, otherwise 0.
+static int use_cache(struct scan_ctx* ctx) {
+
+	const struct scan_params* params = &ctx->params;
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		int err = probe_cache(ctx, target);
+		target->state = TARGET_IDLE;
+		if (err == -EINTR || err == -EIO)
+			return err;
+		if (err != 0)
+			continue;
+
+		long long fresh_since = monotonic_ms() - ctx->max_age_ms;
+		__u32 stale[MAX_SCAN_FREQS];
+		int nstale = 0;
+
+		for (int j = 0; j < params->nfreqs; j++) {
+			if (target->probe_freq_newest_ms[j] < fresh_since)
+				stale[nstale++] = params->freqs[j];
+		}
+		if (params->nfreqs == 0 && target->probe_newest_ms < fresh_since)
+			nstale = 1;
+
+		if (nstale == 0) {
+			target->fresh_since_ms = fresh_since;
+			err = do_scan_dump(ctx, target);
+			target->fresh_since_ms = 0;
+
+			if (err == 0) {
+				scan_log(ctx, target, SCAN_LOG_INFO, "reported the cached results of the last %ld ms, not scanning",
+					ctx->max_age_ms);
+				continue;
+			}
+			if (err == -EINTR || err == -EIO)
+				return err;
+
+			// e.g. the BSSes expired in the meantime
+			target->state = TARGET_IDLE;
+		} else if (nstale < params->nfreqs) {
+			target->partial_msg = trigger_msg_alloc(ctx, target, stale, nstale);
+			if (target->partial_msg == NULL)
+				continue;
+
+			// the channels that are not scanned report their cached BSSes
+			target->fresh_since_ms = fresh_since;
+			scan_log(ctx, target, SCAN_LOG_INFO, "scanning only the %d of %d channels without results of the last %ld ms",
+				nstale, params->nfreqs, ctx->max_age_ms);
+		}
+	}
+
+	return 0;
+}
+
+// Prepares the trigger of the next group of channels of a target
+static void split_next_group(struct scan_ctx* ctx, struct scan_target* target) {
+
+	struct split_scan* split = target->split;
+
+	split->group.clear();
+	split->covered = false;
+	if (split->channels.empty())
+		return;
+
+	for (int i = 0; i < ctx->split_channels && i < (int)split->channels.size(); i++) {
+		split->group.push_back(split->channels[split->next]);
+		split->next = (split->next + 1) % split->channels.size();
+	}
+
+	target->partial_msg = trigger_msg_alloc(ctx, target, split->group.data(), (int)split->group.size());
+	split->group_start_ms = monotonic_ms();
+}
+
+// Triggers the scans of the idle targets and dumps the results of each one as
+// soon as its scan is done. Every target it started ends up done or failed.
+// Returns -EINTR or -EIO if the whole cycle has to end, otherwise 0.
+static int do_scan_attempt(struct scan_ctx* ctx) {
+
+	long long scan_deadline = monotonic_ms() + ctx->timeouts.scan_ms;
+
+	// targets that failed to start are marked as failed by do_scan_trigger()
+	int err = do_scan_trigger(ctx, false);
+
+	// Wait until the scans are done or aborted and dump each one right away
+	while (err != -EINTR && err != -EIO) {
+		struct scan_target* next = NULL;
+		bool scanning = false;
+
+		err = 0;
+
+		for (int i = 0; i < ctx->ntargets; i++) {
+			if (ctx->targets[i].state == TARGET_SCANNED && next == NULL)
+				next = &ctx->targets[i];
+			else if (ctx->targets[i].state == TARGET_SCANNING)
+				scanning = true;
+		}
+
+		if (next != NULL) {
+			scan_log(ctx, next, SCAN_LOG_INFO, "Scan is done");
+			int dump_err = do_scan_dump(ctx, next);
+			if (dump_err == -ENODATA)
+				scan_log(ctx, next, SCAN_LOG_ERROR, "none of the results is recent enough");
+			if (dump_err != 0)
+				target_failed(next, dump_err);
+			if (dump_err == -EINTR || dump_err == -EIO)
+				err = dump_err;
+			continue;
+		}
+
+		if (!scanning)
+			break;
+
+		long timeout = 0;
+		if (ctx->timeouts.scan_ms > 0) {
+			timeout = (long)(scan_deadline - monotonic_ms());
+			if (timeout <= 0) {
+				err = -ETIMEDOUT;
+			}
+		}
+
+		if (err == 0) {
+			err = wait_for(ctx, [](const struct scan_ctx* c) {
+					bool scanning = false;
+					for (int i = 0; i < c->ntargets; i++) {
+						if (c->targets[i].state == TARGET_SCANNED)
+							return false;
+						if (c->targets[i].state == TARGET_SCANNING)
+							scanning = true;
+					}
+					return scanning;
+				}, timeout);
+		}
+
+		if (err == -ETIMEDOUT) {
+			for (int i = 0; i < ctx->ntargets; i++) {
+				struct scan_target* target = &ctx->targets[i];
+
+				if (target->state == TARGET_SCANNING) {
+					scan_log(ctx, target, SCAN_LOG_ERROR, "timed out waiting for the scan to complete");
+					target_failed(target, err);
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		// interrupted by a signal or the socket failed
+		if (target->state != TARGET_DONE && target->state != TARGET_FAILED)
+			target_failed(target, err);
+	}
+
+	return err == -EINTR || err == -EIO ? err : 0;
+}
+
+// A scan that another scanner got in the way of and that is worth another try.
+// Errors of our own, e.g. a request that could not be sent, fail right away.
+static bool scan_retryable(const struct scan_target* target) {
+	return target->state == TARGET_FAILED && (target->err == -EBUSY || target->aborted);
+}
+
+// Picks a delay between half and all of backoff_ms, so that scanners that were
+// turned away together do not come back together
+static long retry_jitter(long backoff_ms) {
+	unsigned long long x = (unsigned long long)monotonic_ns() ^ ((unsigned long long)getpid() << 32);
+
+	// splitmix64 finalizer, the clock alone varies little in its high bits
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return backoff_ms / 2 + (long)(x % (unsigned long long)(backoff_ms - backoff_ms / 2 + 1));
+}
+
+// Runs one scan cycle over all targets: the scans are triggered concurrently and
+// the results of each interface are dumped as soon as its scan is done. Scans
+// that were rejected as busy or aborted are retried as scan_ctx.retry allows and
+// may fall back to the cached results.
+// Returns 0 if every interface succeeded, otherwise the error of the first one
+// that failed.
+int do_scan_cycle(struct scan_ctx* ctx) {
+
+	struct nl_sock* socket = ctx->socket;
+	int err;
+	bool joined = false;
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		for (int i = 0; i < ctx->ntargets; i++) {
+			struct scan_target* target = &ctx->targets[i];
+
+			if (target->partial_msg) {
+				nlmsg_free(target->partial_msg);
+				target->partial_msg = NULL;
+			}
+			target->fresh_since_ms = 0;
+		}
+		if (joined) {
+			nl_socket_drop_membership(socket, ctx->mcid);
+		}
+	});
+
+	// join the netlink socket into the scan group resolved in scan_ctx_init()
+	err = nl_socket_add_membership(socket, ctx->mcid);
+	if (err < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error joining scan group: %d, %s", err, nl_geterror(err));
+		return 1;
+	}
+	joined = true;
+
+	long long retry_deadline = monotonic_ms() + ctx->retry.deadline_ms;
+	long backoff_ms = ctx->retry.initial_ms > 0 ? ctx->retry.initial_ms : 1;
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		ctx->targets[i].state = TARGET_IDLE;
+		ctx->targets[i].aborted = false;
+	}
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (ctx->targets[i].split)
+			split_next_group(ctx, &ctx->targets[i]);
+	}
+
+	err = ctx->max_age_ms > 0 ? use_cache(ctx) : 0;
+
+	while (err == 0) {
+		err = do_scan_attempt(ctx);
+		if (err != 0 || ctx->retry.deadline_ms <= 0)
+			break;
+
+		int retries = 0;
+		for (int i = 0; i < ctx->ntargets; i++) {
+			if (scan_retryable(&ctx->targets[i]))
+				retries++;
+		}
+		long left = (long)(retry_deadline - monotonic_ms());
+		if (retries == 0 || left <= 0)
+			break;
+
+		long delay = retry_jitter(backoff_ms);
+		if (delay > left)
+			delay = left;
+		scan_log(ctx, NULL, SCAN_LOG_INFO, "%d scan(s) rejected as busy or aborted, retrying in %ld ms",
+			retries, delay);
+
+		// events of the other scans are still received while waiting
+		err = wait_for(ctx, [](const struct scan_ctx* c) { return true; }, delay);
+		if (err != -ETIMEDOUT)
+			break;
+		err = 0;
+
+		backoff_ms *= 2;
+		if (ctx->retry.max_ms > 0 && backoff_ms > ctx->retry.max_ms)
+			backoff_ms = ctx->retry.max_ms;
+
+		for (int i = 0; i < ctx->ntargets; i++) {
+			if (scan_retryable(&ctx->targets[i]))
+				ctx->targets[i].state = TARGET_IDLE;
+		}
+	}
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		if (!scan_retryable(target))
+			continue;
+
+		if (target->aborted)
+			scan_log(ctx, target, SCAN_LOG_ERROR, "scan was aborted");
+		else if (ctx->retry.deadline_ms > 0)
+			scan_log(ctx, target, SCAN_LOG_ERROR, "scan was rejected as busy until the retry deadline");
+
+		if (ctx->retry.cache_age_ms <= 0 || err != 0)
+			continue;
+
+		// the kernel keeps the BSSes of earlier scans, also those of other processes
+		int retry_err = target->err;
+		target->fresh_since_ms = monotonic_ms() - ctx->retry.cache_age_ms;
+		int dump_err = do_scan_dump(ctx, target);
+		target->fresh_since_ms = 0;
+
+		if (dump_err == 0) {
+			scan_log(ctx, target, SCAN_LOG_INFO, "reported the cached results of the last %ld ms instead",
+				ctx->retry.cache_age_ms);
+		} else {
+			if (dump_err == -ENODATA)
+				scan_log(ctx, target, SCAN_LOG_ERROR, "no cached results of the last %ld ms either",
+					ctx->retry.cache_age_ms);
+			target_failed(target, retry_err);
+			if (dump_err == -EINTR || dump_err == -EIO)
+				err = dump_err;
+		}
+	}
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (ctx->targets[i].state == TARGET_FAILED)
+			return ctx->targets[i].err;
+	}
+
+	return err;
+}
+
+// Passive mode: stays in the scan multicast group without ever triggering a scan
+// and dumps the results of a target whenever a scan of another process (e.g.
+// wpa_supplicant) on it completes. Runs until stopped or count result sets have
+// been reported (0 = forever).
+int do_passive_listen(struct scan_ctx* ctx, long count) {
+
+	struct nl_sock* socket = ctx->socket;
+	bool joined = false;
+	long dumps = 0;
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		if (joined) {
+			nl_socket_drop_membership(socket, ctx->mcid);
+		}
+	});
+
+	int err = nl_socket_add_membership(socket, ctx->mcid);
+	if (err < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error joining scan group: %d, %s", err, nl_geterror(err));
+		return 1;
+	}
+	joined = true;
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		ctx->targets[i].state = TARGET_SCANNING;
+		ctx->targets[i].rescan_pending = false;
+	}
+
+	scan_log(ctx, NULL, SCAN_LOG_INFO, "Waiting for scan results");
+
+	while (count == 0 || dumps < count) {
+		err = wait_for(ctx, [](const struct scan_ctx* c) {
+				for (int i = 0; i < c->ntargets; i++) {
+					if (c->targets[i].state == TARGET_SCANNED)
+						return false;
+				}
+				return true;
+			}, 0);
+		if (err < 0)
+			return err == -EINTR ? 0 : err;
+
+		for (int i = 0; i < ctx->ntargets && (count == 0 || dumps < count); i++) {
+			struct scan_target* target = &ctx->targets[i];
+
+			if (target->state != TARGET_SCANNED)
+				continue;
+
+			scan_log(ctx, target, SCAN_LOG_INFO, "Scan is done");
+			err = do_scan_dump(ctx, target);
+			if (err == -EINTR)
+				return 0;
+			else if (err == -EIO)
+				return err;
+			dumps++;
+
+			// the results changed while they were dumped, get them again
+			target->state = target->rescan_pending ? TARGET_SCANNED : TARGET_SCANNING;
+			target->rescan_pending = false;
+		}
+	}
+
+	return 0;
+}
+
+// Stops the scheduled scans of the targets that had started one. The kernel handles
+// a request while it is sent, the scan is stopped when this returns; the ack is
+// not waited for.
+static void stop_sched_scans(struct scan_ctx* ctx, const bool* started) {
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		// already stopped by the driver
+		if (!started[i] || target->err == -ECANCELED)
+			continue;
+
+		struct nl_msg* msg = nlmsg_alloc();
+		if (msg == NULL) {
+			scan_log(ctx, target, SCAN_LOG_ERROR, "Failed allocating netlink message");
+			continue;
+		}
+
+		genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, ctx->family_id, 0, 0, NL80211_CMD_STOP_SCHED_SCAN, 0);
+		nla_put_u32(msg, NL80211_ATTR_IFINDEX, target->if_index);
+
+		int ret = send_request(ctx, target, msg);
+		if (ret < 0)
+			scan_log(ctx, target, SCAN_LOG_ERROR, "error stopping the scheduled scan: %d, %s", ret, nl_geterror(ret));
+		nlmsg_free(msg);
+	}
+}
+
+// Scheduled scan mode: the scanning is handed to the firmware, which scans every
+// sched_interval_ms on its own and only wakes the host up when it found a BSS of
+// the match sets. The results of a target are dumped whenever that happens. Runs
+// until stopped, the scheduled scan of every target ended, or count result sets
+// have been reported (0 = forever). The scheduled scans are stopped on return.
+int do_sched_scan(struct scan_ctx* ctx, long count) {
+
+	struct nl_sock* socket = ctx->socket;
+	bool joined = false;
+	bool started[MAX_SCAN_TARGETS] = { false };
+	long dumps = 0;
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		stop_sched_scans(ctx, started);
+		if (joined) {
+			nl_socket_drop_membership(socket, ctx->mcid);
+		}
+	});
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (!ctx->sched || ctx->targets[i].sched_msg == NULL) {
+			scan_log(ctx, NULL, SCAN_LOG_ERROR, "scheduled scan mode was not set up by scan_ctx_init()");
+			return -EINVAL;
+		}
+		ctx->targets[i].state = TARGET_IDLE;
+		ctx->targets[i].rescan_pending = false;
+	}
+
+	int err = nl_socket_add_membership(socket, ctx->mcid);
+	if (err < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error joining scan group: %d, %s", err, nl_geterror(err));
+		return 1;
+	}
+	joined = true;
+
+	err = do_scan_trigger(ctx, true);
+
+	for (int i = 0; i < ctx->ntargets; i++) {
+		struct scan_target* target = &ctx->targets[i];
+
+		started[i] = target->state == TARGET_SCANNING;
+		if (target->state == TARGET_FAILED && target->err == -EOPNOTSUPP)
+			scan_log(ctx, target, SCAN_LOG_ERROR, "the driver does not support scheduled scans");
+	}
+
+	if (err == -EINTR)
+		return 0;
+	else if (err == -EIO)
+		return err;
+
+	scan_log(ctx, NULL, SCAN_LOG_INFO, "Waiting for scheduled scan results");
+
+	while (count == 0 || dumps < count) {
+		bool waiting = false;
+		for (int i = 0; i < ctx->ntargets; i++) {
+			if (ctx->targets[i].state == TARGET_SCANNING || ctx->targets[i].state == TARGET_SCANNED)
+				waiting = true;
+		}
+		if (!waiting)
+			break;
+
+		err = wait_for(ctx, [](const struct scan_ctx* c) {
+				bool scanning = false;
+				for (int i = 0; i < c->ntargets; i++) {
+					if (c->targets[i].state == TARGET_SCANNED)
+						return false;
+					if (c->targets[i].state == TARGET_SCANNING)
+						scanning = true;
+				}
+				return scanning;
+			}, 0);
+		if (err < 0)
+			return err == -EINTR ? 0 : err;
+
+		for (int i = 0; i < ctx->ntargets && (count == 0 || dumps < count); i++) {
+			struct scan_target* target = &ctx->targets[i];
+
+			if (target->state != TARGET_SCANNED)
+				continue;
+
+			scan_log(ctx, target, SCAN_LOG_INFO, "Scheduled scan found a match");
+			err = do_scan_dump(ctx, target);
+			if (err == -EINTR)
+				return 0;
+			else if (err == -EIO)
+				return err;
+			dumps++;
+
+			// the results changed while they were dumped, get them again
+			if (target->err == -ECANCELED)
+				target->state = TARGET_FAILED;
+			else
+				target->state = target->rescan_pending ? TARGET_SCANNED : TARGET_SCANNING;
+			target->rescan_pending = false;
+		}
+	}
+
+	// every scheduled scan ended before count was reached
+	for (int i = 0; i < ctx->ntargets && (count == 0 || dumps < count); i++) {
+		if (ctx->targets[i].state == TARGET_FAILED)
+			return ctx->targets[i].err;
+	}
+
+	return 0;
+}
+
+// Starts a recording, call before scan_ctx_init()
+int scan_record_open(struct scan_ctx* ctx, const char* path) {
+
+	struct record_file_header hdr;
+	FILE* file = fopen(path, "wb");
+
+	if (file == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error opening %s: %d, %s", path, errno, strerror(errno));
+		return 1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RECORD_MAGIC, sizeof(hdr.magic));
+	hdr.version = RECORD_VERSION;
+	hdr.start_ns = realtime_ns();
+
+	if (fwrite(&hdr, sizeof(hdr), 1, file) != 1) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error writing %s: %d, %s", path, errno, strerror(errno));
+		fclose(file);
+		return 1;
+	}
+
+	ctx->recording = new scan_recording();
+	ctx->recording->file = file;
+	ctx->recording->start_ns = monotonic_ns();
+	return 0;
+}
+
+// Publishes the BSS table in a new file that replaces path, so that readers which
+// still have the file of a previous run mapped are not disturbed
+int scan_shm_open(struct scan_ctx* ctx, const char* path) {
+
+	size_t table_size = sizeof(struct apscan_shm_table) + SHM_CAPACITY * sizeof(struct apscan_shm_bss);
+	size_t size = sizeof(struct apscan_shm_header) + 2 * table_size;
+	char tmp_path[PATH_MAX];
+	void* map = MAP_FAILED;
+	int fd = -1;
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmp_path);
+		}
+		if (map != MAP_FAILED)
+			munmap(map, size);
+	});
+
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >= (int)sizeof(tmp_path)) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "path too long: %s", path);
+		return 1;
+	}
+
+	fd = mkstemp(tmp_path);
+	if (fd < 0 || fchmod(fd, 0644) != 0 || ftruncate(fd, size) != 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error creating %s: %d, %s", path, errno, strerror(errno));
+		return 1;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error mapping %s: %d, %s", path, errno, strerror(errno));
+		return 1;
+	}
+
+	// the file is all zeros, an empty table of generation 0 is current
+	struct apscan_shm_header* hdr = (struct apscan_shm_header*)map;
+	memcpy(hdr->magic, APSCAN_SHM_MAGIC, sizeof(hdr->magic));
+	hdr->version = APSCAN_SHM_VERSION;
+	hdr->entry_size = sizeof(struct apscan_shm_bss);
+	hdr->capacity = SHM_CAPACITY;
+	hdr->table_offset[0] = sizeof(*hdr);
+	hdr->table_offset[1] = sizeof(*hdr) + table_size;
+
+	if (rename(tmp_path, path) != 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error creating %s: %d, %s", path, errno, strerror(errno));
+		return 1;
+	}
+	close(fd);
+	fd = -1;
+
+	ctx->shm = new scan_shm();
+	ctx->shm->hdr = hdr;
+	ctx->shm->size = size;
+	map = MAP_FAILED;
+	return 0;
+}
+
+// Feeds a message of a recording through the same handling as a live dump. Scan
+// results make up the dumps, which end with NLMSG_DONE; events and acks are only
+// there for the timing.
+static void replay_message(struct scan_ctx* ctx, struct nlmsghdr* hdr) {
+
+	struct scan_target* target;
+
+	if (hdr->nlmsg_type == NLMSG_DONE) {
+		target = target_by_seq(ctx, hdr->nlmsg_seq);
+		if (target && target->state == TARGET_DUMPING) {
+			if (ctx->stats)
+				stats_dump_message(ctx, target);
+			if (hdr->nlmsg_flags & NLM_F_DUMP_INTR)
+				dump_interrupted(ctx, target);
+			target->req_status = 0;
+
+			// the next dump in the recording is the restart
+			if (dump_restart(ctx, target))
+				return;
+
+			dump_end(ctx, target);
+			target->state = TARGET_DONE;
+		}
+		return;
+	}
+
+	if (!(hdr->nlmsg_flags & NLM_F_MULTI) || hdr->nlmsg_type < NLMSG_MIN_TYPE ||
+		!genlmsg_valid_hdr(hdr, 0) || genlmsg_hdr(hdr)->cmd != NL80211_CMD_NEW_SCAN_RESULTS)
+		return;
+
+	struct nlattr* ifindex = nlmsg_find_attr(hdr, GENL_HDRLEN, NL80211_ATTR_IFINDEX);
+	if (ifindex == NULL || (target = target_by_ifindex(ctx, (int)nla_get_u32(ifindex))) == NULL)
+		return;
+
+	if (target->state != TARGET_DUMPING || target->req_seq != hdr->nlmsg_seq) {
+		// a dump that is done but still DUMPING is restarted by this one
+		if (target->state != TARGET_DUMPING || target->req_status != 0)
+			dump_begin(ctx, target);
+		target->state = TARGET_DUMPING;
+		target->req_seq = hdr->nlmsg_seq;
+		target->req_status = 1;
+	}
+
+	if (ctx->stats)
+		stats_dump_message(ctx, target);
+	if (hdr->nlmsg_flags & NLM_F_DUMP_INTR)
+		dump_interrupted(ctx, target);
+	receive_scan_result(ctx, target, hdr);
+}
+
+// Replays a recording made with scan_record_open() without a socket: the scan
+// results go through the decoder, the diff table and the IE cache to the bss
+// callback like in a live scan. The targets are taken from the recording. With
+// realtime set the messages come at their recorded pace, otherwise as fast as
+// possible.
+int do_replay(struct scan_ctx* ctx, const char* path, bool realtime) {
+
+	const struct record_file_header* file_hdr;
+	int fd = -1;
+	void* map = MAP_FAILED;
+	size_t size = 0;
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		if (map != MAP_FAILED)
+			munmap(map, size);
+		if (fd >= 0)
+			close(fd);
+	});
+
+	fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error opening %s: %d, %s", path, errno, strerror(errno));
+		return -errno;
+	}
+	size = st.st_size;
+
+	if (size < sizeof(*file_hdr)) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "%s is not a recording", path);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "error mapping %s: %d, %s", path, errno, strerror(errno));
+		return -errno;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	file_hdr = (const struct record_file_header*)map;
+	if (memcmp(file_hdr->magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 || file_hdr->version != RECORD_VERSION) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "%s is not a recording", path);
+		return -EINVAL;
+	}
+
+	long long start_ns = monotonic_ns();
+	size_t pos = sizeof(*file_hdr);
+
+	while (pos + sizeof(struct record_header) <= size && !ctx->stop) {
+		const struct record_header* hdr = (const struct record_header*)((const char*)map + pos);
+		const char* data = (const char*)(hdr + 1);
+
+		if (hdr->len > size - pos - sizeof(*hdr)) {
+			// the end of a recording that was cut off
+			break;
+		}
+		pos += sizeof(*hdr) + hdr->len + (8 - hdr->len % 8) % 8;
+
+		if (realtime) {
+			long long due = start_ns + (long long)hdr->time_ns;
+			struct timespec ts = { (time_t)(due / 1000000000), (long)(due % 1000000000) };
+			while (!ctx->stop &&
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+			}
+		}
+
+		switch (hdr->type) {
+		case RECORD_TARGET: {
+			__u32 if_index;
+			struct scan_target* target;
+
+			if (hdr->len < sizeof(if_index) + 1 || ctx->ntargets >= MAX_SCAN_TARGETS)
+				break;
+
+			target = &ctx->targets[ctx->ntargets++];
+			memcpy(&if_index, data, sizeof(if_index));
+			target->if_index = if_index;
+			target->wiphy = -1;
+			snprintf(target->ifname, sizeof(target->ifname), "%.*s",
+				(int)(hdr->len - sizeof(if_index)), data + sizeof(if_index));
+			target_tables_init(ctx, target);
+			break;
+		}
+		case RECORD_MSG_IN: {
+			const struct nlmsghdr* nlh = (const struct nlmsghdr*)data;
+
+			if (hdr->len < sizeof(*nlh) || nlh->nlmsg_len > hdr->len) {
+				scan_log(ctx, NULL, SCAN_LOG_ERROR, "invalid message in %s at offset %zu", path,
+					(size_t)(data - (const char*)map));
+				return -EINVAL;
+			}
+
+			if (ctx->stats)
+				ctx->stats->bytes += nlh->nlmsg_len;
+
+			// handled in place in the read-only mapping, libnl's accessors
+			// only take non-const headers but never write
+			replay_message(ctx, (struct nlmsghdr*)nlh);
+			break;
+		}
+		}
+	}
+
+	return ctx->stop ? -EINTR : 0;
+}
+
+// Callback for NL_CB_VALID while listing the interfaces for --all
+static int interface_handler(struct nl_msg* msg, void* arg) {
+
+	struct scan_ctx* ctx = (scan_ctx*)arg;
+	struct genlmsghdr* gnlh = (genlmsghdr*)nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr* tb[NL80211_ATTR_MAX + 1];
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0), NULL);
+
+	// P2P devices have no netdev and monitor interfaces cannot scan
+	if (!tb[NL80211_ATTR_IFINDEX] || !tb[NL80211_ATTR_IFNAME] || !tb[NL80211_ATTR_WIPHY] ||
+		(tb[NL80211_ATTR_IFTYPE] && nla_get_u32(tb[NL80211_ATTR_IFTYPE]) == NL80211_IFTYPE_MONITOR))
+		return NL_SKIP;
+
+	// All interfaces of a wiphy share its radio, a second scan on the same
+	// radio would only be rejected as busy.
+	int wiphy = (int)nla_get_u32(tb[NL80211_ATTR_WIPHY]);
+	for (int i = 0; i < ctx->ntargets; i++) {
+		if (ctx->targets[i].wiphy == wiphy)
+			return NL_SKIP;
+	}
+
+	if (ctx->ntargets >= MAX_SCAN_TARGETS) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "too many interfaces, ignoring %s", nla_get_string(tb[NL80211_ATTR_IFNAME]));
+		return NL_SKIP;
+	}
+
+	struct scan_target* target = &ctx->targets[ctx->ntargets++];
+	target->if_index = (int)nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	target->wiphy = wiphy;
+	snprintf(target->ifname, sizeof(target->ifname), "%s", nla_get_string(tb[NL80211_ATTR_IFNAME]));
+
+	return NL_SKIP;
+}
+
+// Adds one interface of every wiphy to the targets using NL80211_CMD_GET_INTERFACE.
+// Runs on the still blocking socket before scan_ctx_init().
+int discover_interfaces(struct scan_ctx* ctx) {
+
+	struct nl_msg* msg = nlmsg_alloc();
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		if (msg != NULL) {
+			nlmsg_free(msg);
+		}
+	});
+
+	if (msg == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating netlink message");
+		return 1;
+	}
+
+	genlmsg_put(msg, 0, 0, ctx->family_id, 0, NLM_F_DUMP, NL80211_CMD_GET_INTERFACE, 0);
+
+	int ret = blocking_request(ctx, msg, interface_handler, ctx);
+	if (ret < 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "ERROR: listing interfaces failed with %d, %s", ret, strerror(-ret));
+		return 1;
+	}
+
+	if (ctx->ntargets == 0) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "no wifi interfaces found");
+		return 1;
+	}
+
+	return 0;
+}
+
+// Features of a wiphy that decide which scan options can be used
+struct wiphy_features {
+	int wiphy;
+	__u32 flags;					// NL80211_FEATURE_*
+	__u8 ext[(NUM_NL80211_EXT_FEATURES + 7) / 8];	// NL80211_EXT_FEATURE_* bitmap
+};
+
+// Callback for NL_CB_VALID of NL80211_CMD_GET_INTERFACE for a single interface
+static int wiphy_index_handler(struct nl_msg* msg, void* arg) {
+
+	struct wiphy_features* features = (wiphy_features*)arg;
+	struct nlattr* wiphy = nlmsg_find_attr(nlmsg_hdr(msg), GENL_HDRLEN, NL80211_ATTR_WIPHY);
+
+	if (wiphy)
+		features->wiphy = (int)nla_get_u32(wiphy);
+	return NL_SKIP;
+}
+
+// Callback for NL_CB_VALID of the NL80211_CMD_GET_WIPHY dump. With a split dump
+// the attributes are spread over several messages, so the results are merged.
+static int wiphy_features_handler(struct nl_msg* msg, void* arg) {
+
+	struct wiphy_features* features = (wiphy_features*)arg;
+	struct nlattr* attr;
+
+	attr = nlmsg_find_attr(nlmsg_hdr(msg), GENL_HDRLEN, NL80211_ATTR_FEATURE_FLAGS);
+	if (attr)
+		features->flags |= nla_get_u32(attr);
+
+	attr = nlmsg_find_attr(nlmsg_hdr(msg), GENL_HDRLEN, NL80211_ATTR_EXT_FEATURES);
+	if (attr) {
+		const __u8* ext = (const __u8*)nla_data(attr);
+		for (int i = 0; i < nla_len(attr) && i < (int)sizeof(features->ext); i++)
+			features->ext[i] |= ext[i];
+	}
+
+	return NL_SKIP;
+}
+
+static bool ext_feature_isset(const struct wiphy_features* features, enum nl80211_ext_feature_index f) {
+	return features->ext[f / 8] & (1 << (f % 8));
+}
+
+// Names of the scan flags accepted by --scan-flags
+static const struct {
+	const char* name;
+	__u32 flag;
+} scan_flag_names[] = {
+	{ "low-priority", NL80211_SCAN_FLAG_LOW_PRIORITY },
+	{ "flush", NL80211_SCAN_FLAG_FLUSH },
+	{ "low-span", NL80211_SCAN_FLAG_LOW_SPAN },
+	{ "low-power", NL80211_SCAN_FLAG_LOW_POWER },
+	{ "high-accuracy", NL80211_SCAN_FLAG_HIGH_ACCURACY },
+};
+
+static bool scan_flag_supported(const struct wiphy_features* features, __u32 flag) {
+	switch (flag) {
+	case NL80211_SCAN_FLAG_LOW_PRIORITY:
+		return features->flags & NL80211_FEATURE_LOW_PRIORITY_SCAN;
+	case NL80211_SCAN_FLAG_FLUSH:
+		return features->flags & NL80211_FEATURE_SCAN_FLUSH;
+	case NL80211_SCAN_FLAG_LOW_SPAN:
+		return ext_feature_isset(features, NL80211_EXT_FEATURE_LOW_SPAN_SCAN);
+	case NL80211_SCAN_FLAG_LOW_POWER:
+		return ext_feature_isset(features, NL80211_EXT_FEATURE_LOW_POWER_SCAN);
+	case NL80211_SCAN_FLAG_HIGH_ACCURACY:
+		return ext_feature_isset(features, NL80211_EXT_FEATURE_HIGH_ACCURACY_SCAN);
+	}
+	return false;
+}
+
+// Looks up the wiphy of a target unless it is known already
+static int target_wiphy(struct scan_ctx* ctx, struct scan_target* target) {
+
+	struct wiphy_features features;
+
+	if (target->wiphy >= 0)
+		return 0;
+
+	struct nl_msg* msg = nlmsg_alloc();
+	if (msg == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating netlink message");
+		return 1;
+	}
+
+	genlmsg_put(msg, 0, 0, ctx->family_id, 0, 0, NL80211_CMD_GET_INTERFACE, 0);
+	nla_put_u32(msg, NL80211_ATTR_IFINDEX, target->if_index);
+
+	features.wiphy = -1;
+	int ret = blocking_request(ctx, msg, wiphy_index_handler, &features);
+	nlmsg_free(msg);
+
+	if (ret < 0 || features.wiphy < 0) {
+		scan_log(ctx, target, SCAN_LOG_ERROR, "error finding the wiphy of the interface: %d, %s",
+			ret, strerror(-ret));
+		return 1;
+	}
+	target->wiphy = features.wiphy;
+	return 0;
+}
+
+// Asks the driver of a target which of the requested scan flags and whether a
+// dwell time are supported. Unsupported ones are left out of the scan request
+// with a warning instead of having the kernel reject the whole scan.
+int query_scan_support(struct scan_ctx* ctx, struct scan_target* target) {
+
+	struct wiphy_features features;
+	struct nl_msg* msg = NULL;
+	int ret;
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		if (msg != NULL) {
+			nlmsg_free(msg);
+		}
+	});
+
+	if (target_wiphy(ctx, target) != 0)
+		return 1;
+
+	memset(&features, 0, sizeof(features));
+	features.wiphy = target->wiphy;
+
+	msg = nlmsg_alloc();
+	if (msg == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating netlink message");
+		return 1;
+	}
+
+	// the extended features are only reported by the split dump
+	genlmsg_put(msg, 0, 0, ctx->family_id, 0, NLM_F_DUMP, NL80211_CMD_GET_WIPHY, 0);
+	nla_put_u32(msg, NL80211_ATTR_WIPHY, features.wiphy);
+	nla_put_flag(msg, NL80211_ATTR_SPLIT_WIPHY_DUMP);
+
+	ret = blocking_request(ctx, msg, wiphy_features_handler, &features);
+	if (ret < 0) {
+		scan_log(ctx, target, SCAN_LOG_ERROR, "error reading the wiphy features: %d, %s",
+			ret, strerror(-ret));
+		return 1;
+	}
+
+	target->scan_flags = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(scan_flag_names); i++) {
+		if (!(ctx->params.flags & scan_flag_names[i].flag))
+			continue;
+
+		if (scan_flag_supported(&features, scan_flag_names[i].flag))
+			target->scan_flags |= scan_flag_names[i].flag;
+		else
+			scan_log(ctx, target, SCAN_LOG_INFO, "driver does not support %s scans, ignoring",
+				scan_flag_names[i].name);
+	}
+
+	target->dwell_supported = ext_feature_isset(&features, NL80211_EXT_FEATURE_SET_SCAN_DWELL);
+	if (ctx->params.duration_tu > 0 && !target->dwell_supported)
+		scan_log(ctx, target, SCAN_LOG_INFO, "driver does not support setting the dwell time, ignoring");
+
+	return 0;
+}
+
+// Callback for NL_CB_VALID of the NL80211_CMD_GET_WIPHY dump, collects the
+// channels of every band that are not disabled. A split dump spreads the bands
+// over several messages.
+static int wiphy_channels_handler(struct nl_msg* msg, void* arg) {
+
+	std::vector<__u32>* channels = (std::vector<__u32>*)arg;
+	struct nlattr* bands = nlmsg_find_attr(nlmsg_hdr(msg), GENL_HDRLEN, NL80211_ATTR_WIPHY_BANDS);
+	struct nlattr* band;
+	int rem_band;
+
+	if (bands == NULL)
+		return NL_SKIP;
+
+	nla_for_each_nested(band, bands, rem_band) {
+		struct nlattr* freqs = nla_find((struct nlattr*)nla_data(band), nla_len(band), NL80211_BAND_ATTR_FREQS);
+		struct nlattr* freq;
+		int rem_freq;
+
+		if (freqs == NULL)
+			continue;
+
+		nla_for_each_nested(freq, freqs, rem_freq) {
+			struct nlattr* mhz = nla_find((struct nlattr*)nla_data(freq), nla_len(freq), NL80211_FREQUENCY_ATTR_FREQ);
+
+			if (mhz == NULL ||
+				nla_find((struct nlattr*)nla_data(freq), nla_len(freq), NL80211_FREQUENCY_ATTR_DISABLED))
+				continue;
+			if (!has_channel(*channels, nla_get_u32(mhz)))
+				channels->push_back(nla_get_u32(mhz));
+		}
+	}
+
+	return NL_SKIP;
+}
+
+// Reads the channels of the wiphy of a target that are not disabled
+static int wiphy_channels(struct scan_ctx* ctx, struct scan_target* target, std::vector<__u32>* channels) {
+
+	if (target_wiphy(ctx, target) != 0)
+		return 1;
+
+	struct nl_msg* msg = nlmsg_alloc();
+	if (msg == NULL) {
+		scan_log(ctx, NULL, SCAN_LOG_ERROR, "Failed allocating netlink message");
+		return 1;
+	}
+
+	// the bands of current kernels are only reported by the split dump
+	genlmsg_put(msg, 0, 0, ctx->family_id, 0, NLM_F_DUMP, NL80211_CMD_GET_WIPHY, 0);
+	nla_put_u32(msg, NL80211_ATTR_WIPHY, target->wiphy);
+	nla_put_flag(msg, NL80211_ATTR_SPLIT_WIPHY_DUMP);
+
+	int ret = blocking_request(ctx, msg, wiphy_channels_handler, channels);
+	nlmsg_free(msg);
+	if (ret < 0) {
+		scan_log(ctx, target, SCAN_LOG_ERROR, "error reading the channels of the wiphy: %d, %s",
+			ret, strerror(-ret));
+		return 1;
+	}
+
+	// in the order of the frequencies, so that a group covers neighbouring channels
+	std::sort(channels->begin(), channels->end());
+	return 0;
+}
+
+int query_scan_channels(struct scan_ctx* ctx, struct scan_target* target) {
+
+	if (target->split == NULL) {
+		target->split = new split_scan();
+		target->split->next = 0;
+		target->split->group_start_ms = 0;
+		target->split->covered = false;
+		target->split->replaying = false;
+		target->split->dump = 0;
+	}
+
+	std::vector<__u32>* channels = &target->split->channels;
+	channels->clear();
+
+	if (ctx->params.nfreqs > 0) {
+		channels->assign(ctx->params.freqs, ctx->params.freqs + ctx->params.nfreqs);
+	} else if (wiphy_channels(ctx, target, channels) != 0) {
+		return 1;
+	}
+
+	scan_log(ctx, target, SCAN_LOG_INFO, "scanning %zu channels, %d per cycle", channels->size(),
+		ctx->split_channels);
+	return 0;
+}
@@ -0,0 +1,779 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// The query server, see server.h. Every BSS of the table is in a secondary index
+// by SSID, frequency, security suite and BSSID, so a query only looks at the BSSes
+// its most selective term picks out instead of the whole table.
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "server.h"
+
+const int MAX_CLIENTS = 64;
+
+// a client that sends a longer line is dropped
+const size_t MAX_QUERY_LEN = 1024;
+
+// a client that leaves more of its answers unread is dropped
+const size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+
+// capability bit of BSSes that require encryption
+const __u16 CAPA_PRIVACY = 1 << 4;
+
+typedef std::unordered_set<__u64> key_set;
+
+// A BSS of the table, keyed by interface << 48 | BSSID
+struct server_bss {
+	unsigned char bssid[6];
+	int iface;		// index into query_server.ifnames
+	unsigned int seen;	// last dump of the interface that had it
+
+	bool has_signal_mbm;
+	int signal_mbm;
+	bool has_signal_unspec;
+	__u8 signal_unspec;
+	__u32 freq;
+	__u16 capability;
+
+	// from the decoded elements
+	std::string ssid;			// raw bytes
+	std::vector<std::string> ie_suites;	// RSN, WPA and the names of their suites
+	std::string ie_security;		// the AKM suites (or elements without) joined by +
+};
+
+struct client {
+	std::string in;		// received, without a complete line
+	std::string out;	// answers not written yet
+	bool writing;		// waiting for the socket to take more of out
+	bool eof;		// no more queries, close once out is written
+};
+
+struct query_server {
+	int epoll_fd;
+	int listen_fd;
+	std::string path;
+	bool diff;
+
+	std::vector<std::string> ifnames;
+	std::vector<unsigned int> dumps;	// complete dumps of each interface
+
+	std::unordered_map<__u64, struct server_bss> bsses;
+	std::unordered_map<std::string, key_set> by_ssid;
+	std::unordered_map<__u32, key_set> by_freq;
+	std::unordered_map<std::string, key_set> by_suite;
+	std::unordered_map<__u64, key_set> by_bssid;	// on all interfaces
+
+	std::unordered_map<int, struct client> clients;
+};
+
+enum {
+	SORT_NONE,
+	SORT_SIGNAL,	// strongest first
+};
+
+// A parsed query line. All terms have to match.
+struct query {
+	bool has_ssid;
+	std::string ssid;
+	bool has_bssid;
+	__u64 bssid;
+	bool has_freq;
+	std::vector<__u32> freqs;	// of freq= and channel=, any of them matches
+	bool has_suite;
+	std::string suite;
+	bool has_iface;
+	int iface;			// -1 if the interface is not known
+	int sort;
+	unsigned long limit;		// 0 = all
+};
+
+static __u64 mac_to_key(const unsigned char* mac) {
+	__u64 key = 0;
+	for (int i = 0; i < 6; i++)
+		key = key << 8 | mac[i];
+	return key;
+}
+
+const __u64 MAC_MASK = (1ULL << 48) - 1;
+
+template <typename K>
+static void index_add(std::unordered_map<K, key_set>& index, const K& value, __u64 key) {
+	index[value].insert(key);
+}
+
+template <typename K>
+static void index_remove(std::unordered_map<K, key_set>& index, const K& value, __u64 key) {
+	auto it = index.find(value);
+	if (it == index.end())
+		return;
+	it->second.erase(key);
+	if (it->second.empty())
+		index.erase(it);
+}
+
+template <typename K>
+static const key_set* index_find(const std::unordered_map<K, key_set>& index, const K& value) {
+	auto it = index.find(value);
+	return it == index.end() ? NULL : &it->second;
+}
+
+// The suites a BSS is found by: RSN and WPA and their suites, or WEP or open for
+// BSSes without either element
+static void bss_suites(const struct server_bss* bss, std::vector<std::string>* suites) {
+	if (!bss->ie_suites.empty())
+		*suites = bss->ie_suites;
+	else
+		suites->assign(1, (bss->capability & CAPA_PRIVACY) ? "WEP" : "open");
+}
+
+// Adds a BSS to the indexes by SSID, frequency and suite, or removes it
+static void index_bss(struct query_server* server, __u64 key, const struct server_bss* bss, bool add) {
+	std::vector<std::string> suites;
+
+	bss_suites(bss, &suites);
+	if (add) {
+		index_add(server->by_ssid, bss->ssid, key);
+		index_add(server->by_freq, bss->freq, key);
+		for (const std::string& suite : suites)
+			index_add(server->by_suite, suite, key);
+	} else {
+		index_remove(server->by_ssid, bss->ssid, key);
+		index_remove(server->by_freq, bss->freq, key);
+		for (const std::string& suite : suites)
+			index_remove(server->by_suite, suite, key);
+	}
+}
+
+static void remove_bss(struct query_server* server, std::unordered_map<__u64, struct server_bss>::iterator it) {
+	index_bss(server, it->first, &it->second, false);
+	index_remove(server->by_bssid, it->first & MAC_MASK, it->first);
+	server->bsses.erase(it);
+}
+
+// Name of a suite as the text output prints it, e.g. CCMP or 00-0f-ac:20
+static std::string suite_name(__u32 suite, const char* (*name)(__u32)) {
+	const char* s = name(suite);
+	char id[16];
+
+	if (s != NULL)
+		return s;
+	snprintf(id, sizeof(id), "%02x-%02x-%02x:%u", (suite >> 24) & 0xff, (suite >> 16) & 0xff,
+		(suite >> 8) & 0xff, suite & 0xff);
+	return id;
+}
+
+static void add_suite(std::vector<std::string>* suites, const std::string& name) {
+	if (std::find(suites->begin(), suites->end(), name) == suites->end())
+		suites->push_back(name);
+}
+
+static void add_rsn_suites(struct server_bss* bss, const struct rsn_info* rsn, const char* element) {
+	if (rsn->ie.status != IE_PRESENT)
+		return;
+
+	add_suite(&bss->ie_suites, element);
+	if (rsn->nakm == 0 && bss->ie_security.find(element) == std::string::npos) {
+		// no AKM suite is listed, only the element is known
+		if (!bss->ie_security.empty())
+			bss->ie_security += '+';
+		bss->ie_security += element;
+	}
+	if (rsn->fields & RSN_GROUP_CIPHER)
+		add_suite(&bss->ie_suites, suite_name(rsn->group_cipher, cipher_suite_name));
+	for (int i = 0; i < rsn->npairwise; i++)
+		add_suite(&bss->ie_suites, suite_name(rsn->pairwise[i], cipher_suite_name));
+	for (int i = 0; i < rsn->nakm; i++) {
+		std::string akm = suite_name(rsn->akm[i], akm_suite_name);
+		bool known = std::find(bss->ie_suites.begin(), bss->ie_suites.end(), akm) != bss->ie_suites.end();
+
+		add_suite(&bss->ie_suites, akm);
+		if (known)
+			continue;
+		if (!bss->ie_security.empty())
+			bss->ie_security += '+';
+		bss->ie_security += akm;
+	}
+}
+
+static void set_elements(struct server_bss* bss, const struct bss_ies* ies) {
+	bss->ssid.assign((const char*)ies->ssid.data, ies->ssid.ie.status == IE_PRESENT ? ies->ssid.len : 0);
+	bss->ie_suites.clear();
+	bss->ie_security.clear();
+	add_rsn_suites(bss, &ies->rsn, "RSN");
+	add_rsn_suites(bss, &ies->wpa, "WPA");
+}
+
+static int iface_index(struct query_server* server, const char* ifname) {
+	for (size_t i = 0; i < server->ifnames.size(); i++) {
+		if (server->ifnames[i] == ifname)
+			return (int)i;
+	}
+	server->ifnames.push_back(ifname);
+	server->dumps.push_back(0);
+	return (int)server->ifnames.size() - 1;
+}
+
+void server_update(struct query_server* server, const struct bss_record* bss) {
+
+	int iface = iface_index(server, bss->ifname);
+	__u64 key = (__u64)iface << 48 | mac_to_key(bss->bssid);
+	auto it = server->bsses.find(key);
+
+	if (bss->changes & BSS_GONE) {
+		if (it != server->bsses.end())
+			remove_bss(server, it);
+		return;
+	}
+
+	if (it == server->bsses.end()) {
+		it = server->bsses.emplace(key, server_bss()).first;
+		memcpy(it->second.bssid, bss->bssid, sizeof(it->second.bssid));
+		it->second.iface = iface;
+		index_add(server->by_bssid, key & MAC_MASK, key);
+	} else {
+		index_bss(server, key, &it->second, false);
+	}
+
+	// in diff mode only what changed is set
+	struct server_bss* entry = &it->second;
+	entry->seen = server->dumps[iface];
+	if (bss->changes & BSS_SIGNAL) {
+		entry->has_signal_mbm = bss->has_signal_mbm;
+		entry->signal_mbm = bss->signal_mbm;
+		entry->has_signal_unspec = bss->has_signal_unspec;
+		entry->signal_unspec = bss->signal_unspec;
+	}
+	if (bss->changes & BSS_FREQ)
+		entry->freq = bss->freq;
+	if (bss->changes & BSS_CAPA)
+		entry->capability = bss->has_capability ? bss->capability : 0;
+	if (bss->changes & BSS_IES)
+		set_elements(entry, &bss->elements);
+
+	index_bss(server, key, entry, true);
+}
+
+void server_dump_done(const char* ifname, void* arg) {
+
+	struct query_server* server = (struct query_server*)arg;
+	int iface = iface_index(server, ifname);
+
+	// diff mode reports the BSSes that are gone, and the ones that are left were
+	// not necessarily reported
+	if (!server->diff) {
+		for (auto it = server->bsses.begin(); it != server->bsses.end(); ) {
+			auto next = std::next(it);
+			if (it->second.iface == iface && it->second.seen != server->dumps[iface])
+				remove_bss(server, it);
+			it = next;
+		}
+	}
+
+	server->dumps[iface]++;
+}
+
+// Decodes the \xHH escapes of the text output, returns false if one is malformed
+static bool unescape(const char* s, std::string* out) {
+	out->clear();
+	while (*s) {
+		if (*s != '\\') {
+			*out += *s++;
+			continue;
+		}
+		if (s[1] != 'x' || !isxdigit((unsigned char)s[2]) || !isxdigit((unsigned char)s[3]))
+			return false;
+		char hex[3] = { s[2], s[3], '\0' };
+		*out += (char)strtoul(hex, NULL, 16);
+		s += 4;
+	}
+	return true;
+}
+
+// Frequencies of a channel number in all bands, in MHz
+static void channel_freqs(long channel, std::vector<__u32>* freqs) {
+	if (channel >= 1 && channel <= 13)
+		freqs->push_back(2407 + 5 * channel);
+	if (channel == 14)
+		freqs->push_back(2484);
+	if (channel >= 32 && channel <= 177)
+		freqs->push_back(5000 + 5 * channel);
+	if (channel >= 183 && channel <= 196)
+		freqs->push_back(4000 + 5 * channel);
+	if (channel == 2)
+		freqs->push_back(5935);
+	if (channel >= 1 && channel <= 233 && channel % 4 == 1)
+		freqs->push_back(5950 + 5 * channel);
+	if (channel >= 1 && channel <= 6)
+		freqs->push_back(56160 + 2160 * channel);
+}
+
+// Adds a comma separated list of numbers, as frequencies or channel numbers
+static bool parse_freqs(const char* value, bool channels, std::vector<__u32>* freqs) {
+	const char* p = value;
+
+	while (*p) {
+		char* end;
+		errno = 0;
+		long n = strtol(p, &end, 10);
+		if (errno != 0 || end == p || n <= 0 || n > 100000 || (*end != ',' && *end != '\0'))
+			return false;
+
+		if (channels)
+			channel_freqs(n, freqs);
+		else
+			freqs->push_back((__u32)n);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return true;
+}
+
+// Parses a query line of space separated terms, see the README. Returns false
+// with a message in err if it is malformed.
+static bool parse_query(struct query_server* server, const std::string& line, struct query* q, std::string* err) {
+
+	q->has_ssid = q->has_bssid = q->has_freq = q->has_suite = q->has_iface = false;
+	q->sort = SORT_NONE;
+	q->limit = 0;
+
+	size_t pos = 0;
+	while (pos < line.size()) {
+		size_t end = line.find_first_of(" \t", pos);
+		if (end == std::string::npos)
+			end = line.size();
+		std::string term = line.substr(pos, end - pos);
+		pos = end + 1;
+		if (term.empty())
+			continue;
+
+		size_t eq = term.find('=');
+		if (eq == std::string::npos) {
+			*err = "invalid term: " + term;
+			return false;
+		}
+		std::string name = term.substr(0, eq);
+		const char* value = term.c_str() + eq + 1;
+		bool ok = true;
+
+		if (name == "ssid") {
+			q->has_ssid = true;
+			ok = unescape(value, &q->ssid);
+		} else if (name == "bssid") {
+			unsigned char mac[6];
+			int n = 0;
+			ok = sscanf(value, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n", &mac[0], &mac[1], &mac[2],
+				&mac[3], &mac[4], &mac[5], &n) == 6 && value[n] == '\0';
+			q->has_bssid = true;
+			q->bssid = mac_to_key(mac);
+		} else if (name == "freq" || name == "channel") {
+			q->has_freq = true;
+			ok = parse_freqs(value, name == "channel", &q->freqs);
+		} else if (name == "suite") {
+			q->has_suite = true;
+			ok = unescape(value, &q->suite);
+		} else if (name == "iface") {
+			auto it = std::find(server->ifnames.begin(), server->ifnames.end(), value);
+			q->has_iface = true;
+			q->iface = it == server->ifnames.end() ? -1 : (int)(it - server->ifnames.begin());
+		} else if (name == "sort") {
+			ok = strcmp(value, "signal") == 0;
+			q->sort = SORT_SIGNAL;
+		} else if (name == "limit") {
+			char* end;
+			errno = 0;
+			long limit = strtol(value, &end, 10);
+			ok = errno == 0 && end != value && *end == '\0' && limit > 0;
+			q->limit = (unsigned long)limit;
+		} else {
+			*err = "unknown term: " + name;
+			return false;
+		}
+
+		if (!ok) {
+			*err = "invalid value: " + term;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool query_matches(const struct query* q, const struct server_bss* bss) {
+	if (q->has_ssid && bss->ssid != q->ssid)
+		return false;
+	if (q->has_bssid && mac_to_key(bss->bssid) != q->bssid)
+		return false;
+	if (q->has_freq && std::find(q->freqs.begin(), q->freqs.end(), bss->freq) == q->freqs.end())
+		return false;
+	if (q->has_iface && bss->iface != q->iface)
+		return false;
+	if (q->has_suite) {
+		std::vector<std::string> suites;
+		bss_suites(bss, &suites);
+		if (std::find(suites.begin(), suites.end(), q->suite) == suites.end())
+			return false;
+	}
+	return true;
+}
+
+// Signal strength for sorting. Units of drivers without dBm count as if 100 were
+// 0 dBm and 0 were -100 dBm.
+static int signal_key(const struct server_bss* bss) {
+	if (bss->has_signal_mbm)
+		return bss->signal_mbm;
+	if (bss->has_signal_unspec)
+		return ((int)bss->signal_unspec - 100) * 100;
+	return INT_MIN;
+}
+
+// One line of an answer: bssid,interface,frequency,signal,security,ssid
+static void format_bss(const struct query_server* server, const struct server_bss* bss, std::string* out) {
+	char buf[64];
+
+	mac_addr_n2a(buf, bss->bssid);
+	*out += buf;
+	*out += ',';
+	*out += server->ifnames[bss->iface];
+
+	snprintf(buf, sizeof(buf), ",%u,", bss->freq);
+	*out += buf;
+	if (bss->has_signal_mbm)
+		snprintf(buf, sizeof(buf), "%d,", bss->signal_mbm);
+	else if (bss->has_signal_unspec)
+		snprintf(buf, sizeof(buf), "%uu,", bss->signal_unspec);
+	else
+		snprintf(buf, sizeof(buf), ",");
+	*out += buf;
+
+	if (!bss->ie_security.empty())
+		*out += bss->ie_security;
+	else
+		*out += (bss->capability & CAPA_PRIVACY) ? "WEP" : "open";
+	*out += ',';
+
+	// escaped like the ssid line of the text output
+	size_t len = bss->ssid.size();
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)bss->ssid[i];
+
+		if ((isprint(c) && c != ' ' && c != '\\') || (c == ' ' && i != 0 && i != len - 1)) {
+			*out += (char)c;
+		} else {
+			snprintf(buf, sizeof(buf), "\\x%02x", c);
+			*out += buf;
+		}
+	}
+	*out += '\n';
+}
+
+// Answers a query line: the matching BSSes, one per line, and an empty line
+static void answer_query(struct query_server* server, const std::string& line, std::string* out) {
+
+	struct query q;
+	std::string err;
+
+	if (!parse_query(server, line, &q, &err)) {
+		*out += "error: " + err + "\n\n";
+		return;
+	}
+
+	// the candidates are the BSSes of the smallest index entry a term selects, or
+	// of several for a list of frequencies
+	std::vector<const key_set*> candidates;
+	size_t ncandidates = 0;
+	bool indexed = false;
+
+	auto consider = [&](const std::vector<const key_set*>& sets) {
+		size_t n = 0;
+		for (const key_set* set : sets)
+			n += set ? set->size() : 0;
+		if (!indexed || n < ncandidates) {
+			candidates = sets;
+			ncandidates = n;
+			indexed = true;
+		}
+	};
+
+	if (q.has_ssid)
+		consider({ index_find(server->by_ssid, q.ssid) });
+	if (q.has_bssid)
+		consider({ index_find(server->by_bssid, q.bssid) });
+	if (q.has_suite)
+		consider({ index_find(server->by_suite, q.suite) });
+	if (q.has_freq) {
+		std::vector<const key_set*> sets;
+		for (__u32 freq : q.freqs)
+			sets.push_back(index_find(server->by_freq, freq));
+		consider(sets);
+	}
+
+	std::vector<const struct server_bss*> results;
+	if (indexed) {
+		results.reserve(ncandidates);
+		for (const key_set* set : candidates) {
+			if (set == NULL)
+				continue;
+			for (__u64 key : *set) {
+				const struct server_bss* bss = &server->bsses.find(key)->second;
+				if (query_matches(&q, bss))
+					results.push_back(bss);
+			}
+		}
+	} else {
+		results.reserve(server->bsses.size());
+		for (const auto& it : server->bsses) {
+			if (query_matches(&q, &it.second))
+				results.push_back(&it.second);
+		}
+	}
+
+	size_t count = results.size();
+	if (q.limit > 0 && q.limit < count)
+		count = q.limit;
+
+	if (q.sort == SORT_SIGNAL) {
+		std::partial_sort(results.begin(), results.begin() + count, results.end(),
+			[](const struct server_bss* a, const struct server_bss* b) {
+				return signal_key(a) > signal_key(b);
+			});
+	}
+
+	for (size_t i = 0; i < count; i++)
+		format_bss(server, results[i], out);
+	*out += '\n';
+}
+
+static void client_close(struct query_server* server, int fd) {
+	epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	server->clients.erase(fd);
+}
+
+// Writes as much of the answers as the socket takes and waits for it to take the
+// rest. Returns false if the client is to be dropped.
+static bool client_flush(struct query_server* server, int fd, struct client* c) {
+
+	while (!c->out.empty()) {
+		ssize_t n = send(fd, c->out.data(), c->out.size(), MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n < 0)
+			return false;
+		c->out.erase(0, n);
+	}
+
+	if (c->out.size() > MAX_PENDING_OUTPUT || (c->eof && c->out.empty()))
+		return false;
+
+	bool writing = !c->out.empty();
+	if (writing != c->writing) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = writing ? EPOLLOUT : EPOLLIN;
+		ev.data.fd = fd;
+		if (epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0)
+			return false;
+		c->writing = writing;
+	}
+	return true;
+}
+
+// Answers the complete lines received from a client and keeps the rest
+static void answer_lines(struct query_server* server, struct client* c) {
+
+	size_t start = 0;
+	size_t end;
+	while ((end = c->in.find('\n', start)) != std::string::npos) {
+		std::string line = c->in.substr(start, end - start);
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		answer_query(server, line, &c->out);
+		start = end + 1;
+	}
+	c->in.erase(0, start);
+}
+
+// Receives queries and answers every complete line. A client that shuts down its
+// side gets the answers to what it sent before. Returns false if the client is to
+// be dropped, also as soon as it sent more than MAX_QUERY_LEN without a newline.
+static bool client_read(struct query_server* server, int fd, struct client* c) {
+
+	char buf[4096];
+
+	for (;;) {
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n < 0)
+			return false;
+		if (n == 0) {
+			// the last query may come without a newline
+			if (!c->in.empty())
+				c->in += '\n';
+			c->eof = true;
+			answer_lines(server, c);
+			break;
+		}
+		c->in.append(buf, n);
+		answer_lines(server, c);
+
+		if (c->in.size() > MAX_QUERY_LEN)
+			return false;
+	}
+
+	return true;
+}
+
+static void accept_clients(struct query_server* server) {
+	for (;;) {
+		int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return;
+		}
+
+		if (server->clients.size() >= (size_t)MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			close(fd);
+			continue;
+		}
+		server->clients[fd] = client();
+	}
+}
+
+void server_handle(void* arg) {
+
+	struct query_server* server = (struct query_server*)arg;
+	struct epoll_event events[16];
+
+	int n = epoll_wait(server->epoll_fd, events, 16, 0);
+	for (int i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+
+		if (fd == server->listen_fd) {
+			accept_clients(server);
+			continue;
+		}
+
+		auto it = server->clients.find(fd);
+		if (it == server->clients.end())
+			continue;
+
+		struct client* c = &it->second;
+		bool ok = true;
+		if (!c->writing && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+			ok = client_read(server, fd, c);
+		if (ok)
+			ok = client_flush(server, fd, c);
+		if (!ok)
+			client_close(server, fd);
+	}
+}
+
+int server_fd(const struct query_server* server) {
+	return server->epoll_fd;
+}
+
+struct query_server* server_open(const char* path, bool diff) {
+
+	struct sockaddr_un addr;
+	struct stat st;
+	int listen_fd = -1;
+	int epoll_fd = -1;
+
+	std::shared_ptr<void> defer(nullptr, [&](...){
+		if (listen_fd >= 0)
+			close(listen_fd);
+		if (epoll_fd >= 0)
+			close(epoll_fd);
+	});
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("socket path too long: %s\n", path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	// left behind by a previous run, anything else is not removed
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+		listen(listen_fd, MAX_CLIENTS) != 0) {
+		printf("error listening on %s: %d, %s\n", path, errno, strerror(errno));
+		return NULL;
+	}
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = listen_fd;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) != 0) {
+		printf("error setting up epoll: %d, %s\n", errno, strerror(errno));
+		unlink(path);
+		return NULL;
+	}
+
+	struct query_server* server = new query_server();
+	server->epoll_fd = epoll_fd;
+	server->listen_fd = listen_fd;
+	server->path = path;
+	server->diff = diff;
+	epoll_fd = listen_fd = -1;
+	return server;
+}
+
+void server_close(struct query_server* server) {
+	for (const auto& it : server->clients)
+		close(it.first);
+	close(server->listen_fd);
+	close(server->epoll_fd);
+	unlink(server->path.c_str());
+	delete server;
+}
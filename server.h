@@ -0,0 +1,48 @@
+/**
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Query server of ap-scanner in daemon mode: keeps the BSSes of the last dumps in
+// an indexed table and answers queries on a Unix socket, see the README for the
+// protocol. It runs in the thread of the scan context, as its poll_fd.
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "apscanner.h"
+
+struct query_server;
+
+// Listens on a Unix socket at path, replacing a stale socket file. diff tells if
+// the records come from diff mode, where unchanged BSSes are not reported again.
+// Prints the error and returns NULL on failure.
+struct query_server* server_open(const char* path, bool diff);
+
+// Closes all connections and removes the socket file
+void server_close(struct query_server* server);
+
+// Descriptor that is readable when a client needs attention, for scan_ctx.poll_fd
+int server_fd(const struct query_server* server);
+
+// Accepts connections and answers queries without blocking, the poll_callback
+void server_handle(void* arg);
+
+// Updates the table with a record of the bss_callback
+void server_update(struct query_server* server, const struct bss_record* bss);
+
+// Drops the BSSes of an interface that were not in its last dump, the dump_callback
+void server_dump_done(const char* ifname, void* arg);
+
+#endif